@@ -46,6 +46,7 @@ int g_origin = 1;
 int g_print_prec = 10;
 int g_dbg_flags;
 double g_comp_tol = 1e-14;
+int g_num_threads = 1;
 ENV *g_penv;
 
 char *g_blanks = "      ";
@@ -105,6 +106,9 @@ int main(int argc, char *argv[])
 
 	InitWorkspace(pwksBase, 0);
 	token_init();
+	EvlInitKernels();
+	PoolInit();
+	RandSeed(16807);
 	// The lexer buffer is at the end of the workspace and does not need to
 	// be saved to disk. It needs to be inside the workspace (and cannot be,
 	// for example, a local array in a function) because it contains the
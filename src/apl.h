@@ -67,6 +67,38 @@ typedef unsigned char	uchar;
 typedef unsigned short	ushort;
 typedef	unsigned int	uint;
 typedef unsigned long	ulong;
+typedef	int64_t			aplint;	// Integer array element
+typedef	uint64_t		aplbits;// Packed boolean array word
+
+// Kernels of the dyadic scalar functions (see eval.c and simd.c)
+typedef void (*NUMKERNEL)(double *pz, double *px, double *py, int n);
+typedef int  (*INTKERNEL)(aplint *pz, aplint *px, aplint *py, int n);
+
+#define	KERN_SA		0	// Left argument is a scalar
+#define	KERN_AS		1	// Right argument is a scalar
+#define	KERN_AA		2	// Both are arrays (or both scalars)
+
+// Fold (reduction) kernels of the dyadic scalar functions
+typedef double (*NUMFOLD)(double *px, int n);
+
+// Kernels of the monadic math functions; k○ is at MATH_CIRCLE+k
+typedef void (*MATHKERNEL)(double *pz, double *px, int n);
+
+#define	MATH_CIRCLE		7
+#define	MATH_EXP		15
+#define	MATH_LOG		16
+#define	MATH_KERNELS	17
+
+// Loops run in parallel by PoolFor() call a task for chunks of items
+typedef void (*POOLTASK)(void *parg, int start, int end);
+
+#define	POOL_GRAIN		16384	// Items per chunk; fewer stay serial
+#define	POOL_MAXTHREADS	64		// Maximum value of ⎕NT
+
+// State of a random number generator (see random.c)
+typedef struct {
+	uint64_t	s[4];
+} RANDGEN;
 
 #define	OFFSET(_base,_ptr)	(offset)((char *)(_ptr)  - (char *)(_base))
 #define	POINTER(_base,_off)	(void *)((char *)(_base) + (offset)(_off))
@@ -90,15 +122,51 @@ typedef struct {
 
 // APL data types
 #define	TUND	0			// Undefined
-#define	TINT	1			// Integer - used only to indicate a single index
+#define	TINT	1			// 64-bit integer
 #define	TNUM	2			// Floating-point number
+#define	TBOOL	(TINT|TNUM)	// Packed boolean (1 bit per element)
 #define	TCHR	4			// Character
 #define	TBOX	8			// Box - not implemented
 
+// Integer arrays stored in global variables are squeezed to the
+// narrowest width that holds all their elements. The width bits
+// leave ISNUMBER() true and ISCHAR() false.
+#define	TNARROW	96			// Width bits
+#define	TI8		(TINT|32)	// 8-bit integer
+#define	TI16	(TINT|64)	// 16-bit integer
+#define	TI32	(TINT|96)	// 32-bit integer
+
+// ⍳N and simple transforms of it (a+b×⍳N, ⌽⍳N, N↑⍳M) only keep their
+// first element and step in the descriptor's internal storage. The
+// elements are generated when some function needs them.
+#define	TAP		(TINT|128)	// Arithmetic progression
+#define	AP_BASE(p)	(((aplint *)(p))[0])	// p points to the internal storage
+#define	AP_STEP(p)	(((aplint *)(p))[1])
+
+// Transpose, reverse, take, drop and A[;k] of an array in external
+// storage return a view of its elements (see VIEW below). Views are
+// copied to contiguous storage when some function needs them.
+#define	TVIEW	128			// Strided view
+
 #define	TFUN	16			// Niladic function
 #define	TFUN1	(TFUN+1)	// Monadic function
 #define	TFUN2	(TFUN+2)	// Dyadic function
 
+// Integers and floating-point numbers have the same size, so functions
+// that only move elements around (reshape, catenate, take, etc.) handle
+// both types with the same code. Arithmetic is done on integers while
+// the results fit; otherwise the arguments are converted to doubles.
+
+// Boolean arrays produced by comparisons are packed 64 elements per
+// word, element i being bit i%64 of word i/64. Unused bits of the last
+// word are always 0. Scalars are never packed. Functions that don't
+// know about packed arrays get them unpacked as integers.
+#define	BOOL_WORDS(n)	(((n) + 63) >> 6)
+#define	BOOL_GET(p,i)	((int)((p)[(i) >> 6] >> ((i) & 63)) & 1)
+
+// Size in bytes of an integer element
+#define	INT_WIDTH(t)	((t) == TI8 ? 1 : (t) == TI16 ? 2 : (t) == TI32 ? 4 : 8)
+
 // Macros to access descriptor fields
 #define	TYPE(p)		((p)->type)
 #define	RANK(p)		((p)->rank)
@@ -106,6 +174,7 @@ typedef struct {
 #define	VOFF(p)		((p)->doff)
 #define	VIPTR(p)	&((p)->shape[MINDIM])
 #define VNUM(p) 	*(double *)VIPTR(p)
+#define VINT(p) 	*(aplint *)VIPTR(p)
 #define VCHR(p) 	*(char *)VIPTR(p)
 #define	VPTR(p)		((void *)((ISINTSTO(p) ? (char *)(p)->shape  : (char *)pwksBase) + VOFF(p)))
 #define VAPTR(p,pa)	((void *)((ISINTSTO(p) ? (char *)(pa)->shape : (char *)pwksBase) + VOFF(p)))
@@ -115,6 +184,8 @@ typedef struct {
 #define	ISSCALAR(p)	(RANK(p) == 0)
 #define	ISNUMBER(p)	((p)->type & (TINT | TNUM))
 #define	ISCHAR(p)	((p)->type & TCHR)
+#define	ISINTEGER(t)	(((t) & ~TNARROW) == TINT)	// Any width
+#define	ISNARROW(p)	((p)->type & TNARROW)
 #define	ISFUNCT(p)	((p)->type & TFUN)
 #define	ISINTSTO(p)	(VOFF(p) < sizeof(DESC))	// Internal storage
 #define	ISEXTSTO(p)	(VOFF(p) > sizeof(DESC))	// External storage
@@ -148,6 +219,7 @@ typedef struct {
 	aplshape shape[MAXDIM];	// Array shape
 
 	void *vptr;				// Pointer to elements
+	int width;				// Element size in bytes (0 if packed)
 	int nelem;				// # of elements
 	int step;				// 0 for scalar, 1 for array
 	int size[MAXDIM];		// # of inner elements
@@ -158,6 +230,15 @@ typedef struct {
 	// them always accesses the same element (the scalar).
 } ARRAYINFO;
 
+// Strided view
+// Element (i0,i1,...) is at doff + (i0*stride[0] + i1*stride[1] + ...) * size
+// where size is the size of an element of this type.
+typedef struct {
+	offset	doff;			// Offset of the first element
+	int		type;			// Type of the elements (TINT, TNUM or TCHR)
+	int		stride[MAXDIM];	// Distance between consecutive elements of each axis
+} VIEW;
+
 // Index iterator
 typedef struct {
 	int	type;		// Index type (TNUM, TARR or TNUL)
@@ -167,6 +248,10 @@ typedef struct {
 	int *ptr;		// Pointer to current index (array)
 	int *beg;		// Pointer to first index (array)
 	int *end;		// Pointer to last index+1 (array)
+	int first;		// First index (progression)
+	int step;		// Index increment (progression)
+	int pos;		// Current position (progression)
+	int count;		// Number of indices (progression)
 } INDEX;
 
 int CreateIndex(INDEX *pi, int n);
@@ -318,8 +403,8 @@ typedef struct {
 	char	name[1];/* The name itself, including null terminator */
 } VNAME;
 
-#define	IS_VARIABLE(pn)	((pn)->type < TFUN)
-#define	IS_FUNCTION(pn)	((pn)->type >= TFUN)
+#define	IS_VARIABLE(pn)	(!((pn)->type & TFUN))
+#define	IS_FUNCTION(pn)	((pn)->type & TFUN)
 
 extern size_t  namsz;
 extern char  *pnamBase;
@@ -333,8 +418,11 @@ extern void SetName(int len, char *name, DESC *pd);
 typedef struct {
 	offset	length;		// Total cell length (header + data)
 	offset	follow;		// When in use: DESC that owns it; when free: next block in chain
-#ifdef	APL_SMALL_MM
-	char	pad[sizeof(double)-2*sizeof(offset)];	// Make sure data[] is aligned for doubles
+	offset	refcnt;		// When in use: # of DESCs that share it; when free: 0
+#if	defined(APL_SMALL_MM)
+	char	pad[sizeof(double)-3*sizeof(offset)];	// Make sure data[] is aligned for doubles
+#elif defined(APL_LARGE_MM)
+	char	pad[2*sizeof(double)-3*sizeof(offset)];
 #endif
 } HEAPCELL;
 
@@ -482,6 +570,10 @@ typedef struct env {
 #define	EX_KEEP_LAST	1	// Keep last value of ExprList on the stack
 #define	KEEP_LAST(e)	((e)->flags & EX_KEEP_LAST)
 
+// Set when a local variable of a function gets a heap cell with room to
+// grow (V←V,X). Such cells are freed when the function returns.
+#define	EX_OWN_CELLS	2
+
 // Printing formats for numbers
 #define	FMT_INT		1		// Generic, no exp (3, ¯25, 1.345)
 #define	FMT_DEC		2		// Decimal (3.00, 4.567)
@@ -512,6 +604,8 @@ typedef struct {
 #define	SYS_DBG			11	// Debug flags
 #define	SYS_PID			12	// Process id
 #define	SYS_LU			13	// LU Matrix decomposition
+#define	SYS_NT			14	// Number of threads
+#define	SYS_RL			15	// Random link
 
 // Miscelaneous
 #define	TRUE	1
@@ -531,6 +625,9 @@ extern int		g_origin;
 extern int		g_print_prec;
 extern int		g_dbg_flags;
 extern double	g_comp_tol;
+extern int		g_num_threads;
+extern RANDGEN	g_rand;
+extern int		g_rand_seed;
 extern char	*	g_blanks;
 extern char	*	g_blanks_del;
 extern char *	g_del;
@@ -548,6 +645,7 @@ extern ENV *	g_penv;
 // Global functions
 extern offset AplHeapAlloc(int size, offset off);
 extern void AplHeapFree(offset off);
+extern void AplHeapRelease(DESC *pd);
 extern void Beep(void);
 extern void DescPrint(DESC *popr);
 extern void DescPrintln(DESC *popr);
@@ -555,6 +653,7 @@ extern void EmitNumber(LEXER *plex, double num);
 extern void EmitTok(LEXER *plex, int tok);
 extern void EvlExpr(ENV *penv);
 extern void EvlExprList(ENV *penv);
+extern void EvlInitKernels(void);
 extern void EvlResetStacks(void);
 extern int  GetChar(void);
 extern int  FGetLine(FILE *pf, char *achLine, int nLen);
@@ -567,7 +666,17 @@ extern void	PopEnv(ENV *penv);
 extern void put_char(int chr);
 extern void print_dash_line(int len, char *szFmt, ...);
 extern int	print_line(char *szFmt, ...);
+extern void	PoolError(int errnum);
+extern int	PoolFor(POOLTASK task, void *parg, int n, int grain);
+extern void	PoolInit(void);
+extern uint64_t	RandBelow(RANDGEN *pg, uint64_t n);
+extern uint64_t	RandNext(RANDGEN *pg);
+extern void	RandRoll(RANDGEN *pg, double *pz, double *px, int n);
+extern void	RandSeed(int seed);
+extern void	RandSplit(RANDGEN *pg, uint64_t base, int index);
 extern int	Read_line(char *prompt, char *buffer, int buflen);
+extern void SimdKernels(int fun, NUMKERNEL num[3], INTKERNEL ints[3], NUMFOLD *fold);
+extern void SimdMathKernels(MATHKERNEL math[MATH_KERNELS]);
 extern void SysCommand(char *pcmd);
 extern void	*TempAlloc(int size, int nItems);
 
@@ -2,11 +2,13 @@
 // Copyright (c) 2021 José Cordeiro
 
 #include <assert.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <float.h>
+#include <limits.h>
 #include <math.h>
 #include <unistd.h>
 #include <sys/time.h>
@@ -18,24 +20,43 @@
 
 char   *CharAlloc(DESC *pd, size_t nelem);
 double *DoubleAlloc(DESC *pd, size_t nelem);
+aplint *IntAlloc(DESC *pd, size_t nelem);
+aplbits *BoolAlloc(DESC *pd, size_t nelem);
 
 static void		ArrayInfo(ARRAYINFO *pai);
 static int *	AsInt(DESC *pd, int nelem);
 static double	Binomial(double x, double y);
+static int		BoolCount(aplbits *pbits, int start, int len);
+static void		BoolToInt(DESC *pd);
+static void		IntWiden(DESC *pd);
+static void		IntSqueeze(DESC *pd);
+static int		IntFits(DESC *pd, int type);
+static void		ToInt(DESC *pd);
+static VIEW		*ViewOf(DESC *pd);
+static void		ViewExpand(DESC *pd);
+static void		ViewDetach(DESC *pd);
+static int		ViewTakeDrop(int *spec, int n, int drop);
+static void		ApSet(DESC *pd, int nelem, aplint base, aplint step);
+static int		ApDyadicFun(int fun, int axis_type);
+static int		ApMonadicFun(int fun, int axis_type);
+static int		ReduceAp(int fun);
 static int		Conformable(DESC *pv1, DESC *pv2);
 static int 		DyadicConformable(ARRAYINFO *p1, ARRAYINFO *p2, DESC *pr);
 static void		EvlAtom(ENV *penv);
 static int		EvlBranchLine(int old);
-static double	EvlCircularFun(int fun, double arg);
+static void		EvlBoolOuterProd(int fun, ARRAYINFO *L, ARRAYINFO *R);
+static void		EvlDyadicBoolFun(int fun, ARRAYINFO *pL, ARRAYINFO *pR, int nelem);
 static void		EvlDyadicFun(int fun, int axis, int axis_type);
+static int		EvlDyadicIntFun(int fun, ARRAYINFO *pL, ARRAYINFO *pR, int nelem);
 static void		EvlDyadicNumFun(int fun);
 static void		EvlDyadicStrFun(int fun);
 static void		EvlFunction(FUNCTION *pfun);
 static void		EvlGetIndex(int n);
 static int		EvlIndex(ENV *penv);
 static void		EvlInnerProd(int funL, int funR);
-static void		EvlSetIndex(int n);
+static void		EvlSetIndex(DESC *pd, int n);
 static void		EvlMonadicFun(ENV *penv, int fun, int axis, int axis_type);
+static int		EvlMonadicIntFun(int fun);
 static void		EvlOuterProd(int fun);
 static void		ExtendArray(ARRAYINFO *pai, int axis);
 static void		ExtendScalar(ARRAYINFO *psrc, ARRAYINFO *pdst, int axis);
@@ -53,9 +74,12 @@ static void		FunFormat2(void);
 static void		FunGradeUpDown(int fun);
 static void		FunIota(void);
 static void		FunIndexOf(void);
+static void		FunIntervalIndex(void);
 static void		FunMatDivide(void);
 static void		FunMatInverse(void);
 static void		FunMembership(void);
+static void		FunUnique(void);
+static void		FunWithout(void);
 static void		FunReshape(void);
 static void		FunReverse(int axis);
 static void		FunRotate(int axis);
@@ -63,25 +87,46 @@ static void		FunShape(void);
 static void		FunSystem1(int fun);
 static void		FunTake(void);
 static void		FunTranspose(void);
+static int		FuseChain(ENV *penv);
+static void		InfoToDouble(ARRAYINFO *pai);
+static void		TempToDouble(ARRAYINFO *pai);
+static double *	IntToDouble(aplint *pint, int nelem);
+static int		IsBoolFun(int fun);
+static int		IsIntFun(int fun);
 static int		IsNullArray(DESC *pd);
 static int		NumElem(DESC *pv);
+static int		IsDeadTemp(void *ptr, int size, DESC *pfrom);
 static void		OperPush(int type, int rank);
 static void		OperPushDesc(DESC *pd);
 static void		OperSwap(void);
 static void		QuadInp(ENV *penv);
 static void		QuoteQuadInp(void);
 static void		Reduce(int fun, int dim);
+static int		ReduceBool(int fun, int axis);
+static int		ReduceInt(int fun, int axis, ARRAYINFO *pA, aplint *pnew);
 static void		Scan(int fun, int dim);
+static int		ScanBool(int fun);
 static void		SysIdent(void);
 static void		SysLU(void);
 static void		SysRref(void);
+static void		ToDouble(DESC *pd);
 static FUNCTION* VarGetFun(ENV *penv);
 static void		VarGetNam(ENV *penv);
 static void		VarGetInx(ENV *penv);
 static void		VarGetSys(ENV *penv);
 static void		VarSetInx(ENV *penv, int dims);
 static void		VarSetNam(ENV *penv, int dims);
+static void		VarStore(DESC *pd, int oldsize);
+static int		DataSize(DESC *pd);
+static HEAPCELL *HeapCell(offset off);
+static void		HeapFreeLocals(DESC *pfirst, DESC *plast, DESC *pret);
+static int		HeapCellUsed(HEAPCELL *pc, DESC *pd);
+static void		HeapUnshare(DESC *pd);
 static void		VarSetSys(ENV *penv);
+static int		VarAppend(ENV *penv);
+
+// # of heap cells owned by local variables (see VarAppend)
+static int nLocalCells;
 
 char *apchEvlMsg[] =
 {
@@ -170,6 +215,10 @@ void EvlExprList(ENV *penv)
 // Reset evaluation stacks
 void EvlResetStacks(void)
 {
+	// Heap cells of locals left behind by an interrupted function
+	if (nLocalCells)
+		HeapFreeLocals((DESC *)phepTop, pdesBase, NULL);
+
 	poprTop = pdesBase;
 	parrTop = parrBase;
 }
@@ -200,6 +249,7 @@ void EvlExpr(ENV *penv)
 			if (!ISNUMBER(poprTop) || !ISSCALAR(poprTop))
 				EvlError(EE_DOMAIN);
 
+			ToDouble(poprTop);
 			axis = (int)VNUM(poprTop);
 			if ((double)axis == VNUM(poprTop)) {
 				// Integer: regular axis
@@ -271,6 +321,14 @@ void EvlExpr(ENV *penv)
 			VALIDATE_AXIS(poprTop,APL_BACKSLASH);
 			Scan(nxt, axis);
 			penv->pCode += 2;
+		} else if (fun == APL_COMMA && axis_type == AXIS_DEFAULT && VarAppend(penv)) {
+			// V←V,X done in place; drop the value as an assignment would
+			if (*penv->pCode == APL_DIAMOND)
+				POP(poprTop);
+			else if ((*penv->pCode == APL_END || *penv->pCode == APL_NL) && !KEEP_LAST(penv))
+				POP(poprTop);
+		} else if (axis_type == AXIS_DEFAULT && FuseChain(penv)) {
+			// A chain of scalar functions was done in one pass
 		} else if (IsDyadic(fun) && IsAtom(nxt)) {
 			++penv->pCode;
 			EvlAtom(penv);
@@ -342,6 +400,17 @@ static void EvlAtom(ENV *penv)
 		VOFF(poprTop) = WKSOFF(penv->plitBase + *penv->pCode++);
 		break;
 
+	case APL_INT:	// Integer literals are stored in the same table
+		OperPush(TINT,0);
+		VINT(poprTop) = *(aplint *)(penv->plitBase + *penv->pCode++);
+		break;
+
+	case APL_IARR:
+		OperPush(TINT,1);
+		SHAPE(poprTop)[0] = *penv->pCode++;
+		VOFF(poprTop) = WKSOFF(penv->plitBase + *penv->pCode++);
+		break;
+
 	case APL_STR:
 		OperPush(TCHR,1);
 		len = *penv->pCode++;
@@ -412,6 +481,7 @@ static void EvlGetIndex(int n)
 	int		d, i, j, ind, len, m, r, t;
 	DESC	*popr;
 	INDEX	*p;
+	VIEW	*pv;
 
 	// A[I]
 
@@ -423,6 +493,12 @@ static void EvlGetIndex(int n)
 	if (RANK(poprTop) != n)
 		EvlError(EE_NOT_CONFORMABLE);
 
+	// Unpack boolean or narrow array and indices
+	// Progressions and a viewed array are read directly
+	for (i = 0; i <= n; ++i)
+		if (TYPE(poprTop + i) != TAP && !(i == 0 && TYPE(poprTop) == TVIEW))
+			ToInt(poprTop + i);
+
 	// Calculate rank and shape of result
 	// Shape of result is , of the shapes of the indices
 	// d -> dimension 0 <= d < n = RANK(array)
@@ -435,7 +511,9 @@ static void EvlGetIndex(int n)
 				EvlError(EE_ARRAY_OVERFLOW);
 			shape[r++] = SHAPE(poprTop)[d];
 			break;
+		case TINT:
 		case TNUM:
+		case TAP:
 			if (ISSCALAR(popr))	// Single index
 				break;
 			i = RANK(popr);		// Array of indices
@@ -452,17 +530,60 @@ static void EvlGetIndex(int n)
 	// Create index iterator and get first index
 	ind = CreateIndex(indices, n);
 
+	// Single indices and full axes (A[2;] or A[;5]) of a view or of
+	// an array in external storage build another view
+	for (d = 0; d < n && (indices[d].type == TUND || indices[d].type == TINT); ++d)
+		;
+	if (r && d == n && (pv = ViewOf(poprTop)) != NULL) {
+		int size = pv->type == TCHR ? sizeof(char) : sizeof(double);
+		DESC view;
+
+		for (d = 0, i = 0; d < n; ++d) {
+			if (indices[d].type == TUND)
+				pv->stride[i++] = pv->stride[d];
+			else
+				pv->doff += (ptrdiff_t)indices[d].index * pv->stride[d] * size;
+		}
+
+		// Drop indices and leave the view on the top
+		view = *poprTop;
+		poprTop += n;
+		*poprTop = view;
+		RANK(poprTop) = r;
+		COPY_SHAPE(SHAPE(poprTop), shape, r);
+		return;
+	}
+
 	ArrayInfo(&A);
 	t = TYPE(poprTop);
 
+	// Elements of a progression are generated as needed
+	if (t == TAP) {
+		aplint *pap = A.vptr;
+		aplint *pnew;
+
+		for (i = 0, m = 1; i < r; ++i)
+			m *= shape[i];
+		poprTop += n;
+		TYPE(poprTop) = TINT;
+		RANK(poprTop) = r;
+		COPY_SHAPE(SHAPE(poprTop), shape, r);
+		pnew = IntAlloc(poprTop, m);
+		do {
+			*pnew++ = AP_BASE(pap) + AP_STEP(pap) * ind;
+			ind = NextIndex(indices, n);
+		} while (ind >= 0);
+		return;
+	}
+
 	// Result is a single element (rank = 0)
 	if (!r) {
-		if (t == TNUM) {
+		if (t != TCHR) {
 			double *pold;
-			// 1 real number
+			// 1 number (integer or real)
 			pold = A.vptr;
 			poprTop += n;
-			TYPE(poprTop) = TNUM;
+			TYPE(poprTop) = t;
 			RANK(poprTop) = 0;
 			VNUM(poprTop) = pold[ind];
 			return;
@@ -492,7 +613,7 @@ static void EvlGetIndex(int n)
 	COPY_SHAPE(SHAPE(poprTop), shape, r);
 
 	// Copy indexed elements to new array
-	if (t == TNUM) {
+	if (t != TCHR) {
 		double *pold, *pnew;
 
 		pold = A.vptr;
@@ -515,7 +636,9 @@ static void EvlGetIndex(int n)
 	}
 }
 
-static void EvlSetIndex(int n)
+// X[I]←Y stores the elements of Y directly into the storage of
+// descriptor pd (the variable X), which must not be shared
+static void EvlSetIndex(DESC *pd, int n)
 {
 	INDEX	indices[MAXDIM];
 	aplshape	shape[MAXDIM];		// Shape of index array
@@ -526,7 +649,7 @@ static void EvlSetIndex(int n)
 
 	// X[I]←Y
 
-	// Stack has: top -> X
+	// Stack has: top -> X (copy of *pd)
 	//                   I (n)
 	//                   Y
 	if (!ISARRAY(poprTop))
@@ -535,10 +658,15 @@ static void EvlSetIndex(int n)
 	if (RANK(poprTop) != n)
 		EvlError(EE_NOT_CONFORMABLE);
 
+	// Unpack boolean indices (X is written through pd)
+	for (i = 1; i <= n; ++i)
+		if (TYPE(poprTop + i) != TAP)
+			ToInt(poprTop + i);
+
 	// Create index iterator and get first index
 	ind = CreateIndex(indices, n);
-	parr = VPTR(poprTop);
-	t = TYPE(poprTop);
+	parr = VPTR(pd);
+	t = TYPE(pd);
 
 	// Calculate rank and shape of index (I)
 	// It must conform to the shape of the value (Y)
@@ -551,7 +679,9 @@ static void EvlSetIndex(int n)
 				EvlError(EE_ARRAY_OVERFLOW);
 			shape[r++] = SHAPE(poprTop)[i];
 			break;
+		case TINT:
 		case TNUM:
+		case TAP:
 			if (ISSCALAR(popr))	// Single index
 				break;
 			d = RANK(popr);		// Array of indices
@@ -568,9 +698,18 @@ static void EvlSetIndex(int n)
 	// Drop old value (X) and indices (I)
 	// Leave Y on the top
 	poprTop += n + 1;
-
-	if (TYPE(poprTop) != t)
-		EvlError(EE_DOMAIN);
+	ToInt(poprTop);
+
+	// Integer values can be stored in a floating-point array.
+	// The caller has already converted an integer array that
+	// is going to receive floating-point values, and has checked
+	// that integers fit into a boolean or narrow array.
+	if (TYPE(poprTop) != t) {
+		if (t == TNUM && TYPE(poprTop) == TINT)
+			ToDouble(poprTop);
+		else if ((t != TBOOL && !ISINTEGER(t)) || TYPE(poprTop) != TINT)
+			EvlError(EE_DOMAIN);
+	}
 	if (ISARRAY(poprTop)) {
 		// I and Y must have the same shape
 		if (RANK(poprTop) != r)
@@ -585,7 +724,32 @@ static void EvlSetIndex(int n)
 	pval = VPTR(poprTop);
 
 	// Copy indexed elements to array
-	if (t == TNUM) {
+	if (t == TBOOL) {
+		aplbits *pdst = parr;
+		aplint *psrc = pval;
+
+		do {
+			if (*psrc)
+				pdst[ind >> 6] |= (aplbits)1 << (ind & 63);
+			else
+				pdst[ind >> 6] &= ~((aplbits)1 << (ind & 63));
+			psrc += step;
+			ind = NextIndex(indices, n);
+		} while (ind >= 0);
+	} else if (ISNARROW(pd)) {
+		aplint *psrc = pval;
+		int width = INT_WIDTH(t);
+
+		do {
+			switch (width) {
+			case 1:	((int8_t *)parr)[ind] = (int8_t)*psrc; break;
+			case 2:	((int16_t *)parr)[ind] = (int16_t)*psrc; break;
+			case 4:	((int32_t *)parr)[ind] = (int32_t)*psrc; break;
+			}
+			psrc += step;
+			ind = NextIndex(indices, n);
+		} while (ind >= 0);
+	} else if (t != TCHR) {
 		double *psrc, *pdst;
 
 		pdst = parr;
@@ -647,9 +811,29 @@ int CreateIndex(INDEX *pi, int n)
 			p->index = 0;
 			p->type = TUND;
 			break;
+		case TAP: {					// Progression of indices  M[⍳5;2]
+			aplint *pap = VPTR(popr);
+			aplint base = AP_BASE(pap);
+			int count = SHAPE(popr)[0];
+			aplint last = base + AP_STEP(pap) * (count - 1);
+			// All indices are valid if the first and last ones are
+			if (!count || base < g_origin || base - g_origin >= p->shape ||
+				last < g_origin || last - g_origin >= p->shape)
+				EvlError(EE_INVALID_INDEX);
+			p->first = p->index = (int)(base - g_origin);
+			p->step = count > 1 ? (int)AP_STEP(pap) : 0;
+			p->pos = 0;
+			p->count = count;
+			p->type = TAP;
+			break;
+		}
+		case TINT:
 		case TNUM:
 			if (ISSCALAR(popr)) {	// Single index      M[2;3]
-				p->index = (int)VNUM(popr) - g_origin;
+				if (TYPE(popr) == TINT)	// Out of range fails below
+					p->index = VINT(popr) < 0 || VINT(popr) > MAXIND ? -1 : (int)VINT(popr) - g_origin;
+				else
+					p->index = (int)VNUM(popr) - g_origin;
 				p->type = TINT;
 				break;
 			} else {				// Array of indices  M[2 3;4 5]
@@ -693,6 +877,14 @@ int NextIndex(INDEX *pi, int n)
 		case TINT:
 			// Cannot advance; must backtrack
 			break;
+		case TAP:
+			if (++p->pos < p->count) {
+				p->index += p->step;
+				goto get_index;
+			}
+			p->pos = 0;
+			p->index = p->first;
+			break;
 		case TNUM:
 			if (++p->ptr < p->end) {
 				p->index = *p->ptr - g_origin;
@@ -897,254 +1089,1218 @@ get_index:
 	return 1;	// Continue
 }
 
-static inline double EvlDyadicScalarNumFun(int fun, double numL, double numR)
+// Monadic math kernels
+//
+// Exponential, logarithm and the circle functions are applied to n
+// doubles at a time by kernels like the dyadic ones below. They are
+// indexed by MATH_EXP, MATH_LOG and MATH_CIRCLE plus the left argument
+// of ○. EvlInitKernels() replaces some of them by vector versions.
+// MonadicKernel() finds the kernel of any monadic scalar function.
+#define	MATH_KERNEL(name, expr, bad, err)				\
+static void name(double *pz, double *px, int n)			\
+{														\
+	double x;											\
+	int fail = 0;										\
+	for (int i = 0; i < n; ++i) {						\
+		x = px[i];										\
+		fail |= (bad);									\
+		pz[i] = (expr);									\
+	}													\
+	if (fail)											\
+		EvlError(err);									\
+}
+
+// Outside of [-1,1]
+#define	NOT_UNIT(x)		!((x) >= -1.0 && (x) <= 1.0)
+
+MATH_KERNEL(MathAtanh,	atanh(x),			!(x > -1.0 && x < 1.0),		EE_DOMAIN)
+MATH_KERNEL(MathAcosh,	acosh(x),			!(x >= 1.0),				EE_DOMAIN)
+MATH_KERNEL(MathAsinh,	asinh(x),			0,							0)
+MATH_KERNEL(MathSqrtM1,	sqrt(-1.0 + x * x),	!(x <= -1.0 || x >= 1.0),	EE_DOMAIN)
+MATH_KERNEL(MathAtan,	atan(x),			0,							0)
+MATH_KERNEL(MathAcos,	acos(x),			NOT_UNIT(x),				EE_DOMAIN)
+MATH_KERNEL(MathAsin,	asin(x),			NOT_UNIT(x),				EE_DOMAIN)
+MATH_KERNEL(MathSqrt1M,	sqrt(1.0 - x * x),	NOT_UNIT(x),				EE_DOMAIN)
+MATH_KERNEL(MathSin,	sin(x),				0,							0)
+MATH_KERNEL(MathCos,	cos(x),				0,							0)
+MATH_KERNEL(MathTan,	tan(x),				0,							0)
+MATH_KERNEL(MathSqrt1P,	sqrt(1.0 + x * x),	0,							0)
+MATH_KERNEL(MathSinh,	sinh(x),			0,							0)
+MATH_KERNEL(MathCosh,	cosh(x),			0,							0)
+MATH_KERNEL(MathTanh,	tanh(x),			0,							0)
+MATH_KERNEL(MathExp,	exp(x),				0,							0)
+MATH_KERNEL(MathLog,	log(x),				x == 0,						EE_DOMAIN)
+MATH_KERNEL(MathPiTimes,	x * M_PI,		0,							0)
+MATH_KERNEL(MathNeg,	-x,					0,							0)
+MATH_KERNEL(MathAbs,	fabs(x),			0,							0)
+MATH_KERNEL(MathCeil,	ceil(x),			0,							0)
+MATH_KERNEL(MathFloor,	floor(x),			0,							0)
+MATH_KERNEL(MathSignum,	SIGN(x),			0,							0)
+MATH_KERNEL(MathRecip,	1.0 / x,			x == 0,						EE_DIVIDE_BY_ZERO)
+
+static MATHKERNEL MathKernels[MATH_KERNELS] = {
+	[MATH_CIRCLE - 7]	= MathAtanh,	// Inverse hyperbolic tangent
+	[MATH_CIRCLE - 6]	= MathAcosh,	// Inverse hyperbolic cosine
+	[MATH_CIRCLE - 5]	= MathAsinh,	// Inverse hyperbolic sine
+	[MATH_CIRCLE - 4]	= MathSqrtM1,	// Sqrt(-1 + arg^2)
+	[MATH_CIRCLE - 3]	= MathAtan,		// Arc tangent
+	[MATH_CIRCLE - 2]	= MathAcos,		// Arc cosine
+	[MATH_CIRCLE - 1]	= MathAsin,		// Arc sine
+	[MATH_CIRCLE]		= MathSqrt1M,	// Sqrt(1 - arg^2)
+	[MATH_CIRCLE + 1]	= MathSin,		// Sine
+	[MATH_CIRCLE + 2]	= MathCos,		// Cosine
+	[MATH_CIRCLE + 3]	= MathTan,		// Tangent
+	[MATH_CIRCLE + 4]	= MathSqrt1P,	// Sqrt(1 + arg^2)
+	[MATH_CIRCLE + 5]	= MathSinh,		// Hyperbolic sine
+	[MATH_CIRCLE + 6]	= MathCosh,		// Hyperbolic cosine
+	[MATH_CIRCLE + 7]	= MathTanh,		// Hyperbolic tangent
+	[MATH_EXP]			= MathExp,
+	[MATH_LOG]			= MathLog,
+};
+
+// Kernel of fun○
+static MATHKERNEL CircleKernel(int fun)
 {
-	double res;
+	if (fun < -7 || fun > 7)
+		EvlError(EE_DOMAIN);
+
+	return MathKernels[MATH_CIRCLE + fun];
+}
 
+// Kernel of a monadic scalar function on doubles, NULL if there is none
+static MATHKERNEL MonadicKernel(int fun)
+{
 	switch (fun) {
-	case APL_CIRCLE:
-		res = EvlCircularFun((int)numL, numR);
-		break;
-	case APL_UP_STILE:
-		res = max(numL, numR);
-		break;
-	case APL_DOWN_STILE:
-		res = min(numL, numR);
-		break;
-	case APL_PLUS:
-		res = numL + numR;
-		break;
-	case APL_MINUS:
-		res = numL - numR;
-		break;
-	case APL_LESS_THAN:
-		res = numL < numR;
-		break;
-	case APL_EQUAL:
-		res = numL == numR;
-		break;
-	case APL_GREATER_THAN:
-		res = numL > numR;
-		break;
-	case APL_TIMES:
-		res = numL * numR;
-		break;
-	case APL_DIV:
-		if (!numR)
-			EvlError(EE_DIVIDE_BY_ZERO);
-		res = numL / numR;
-		break;
-	case APL_EXCL_MARK:
-		res = Binomial(numL, numR);
-		break;
-	case APL_STILE:
-		if (numL != 0)
-			res = fmod(numR, numL);
-		else {
-			if (numR >= 0)
-				res = numR;
-			else
-				EvlError(EE_DOMAIN);
-		}
-		break;
-	case APL_STAR:
-		res = pow(numL, numR);
-		break;
-	case APL_AND:
-		if ((numL != 0 && numL != 1) || (numR != 0 && numR != 1))
-			EvlError(EE_DOMAIN);
-		res = numL && numR;
-		break;
-	case APL_OR:
-		if ((numL != 0 && numL != 1) || (numR != 0 && numR != 1))
-			EvlError(EE_DOMAIN);
-		res = numL || numR;
-		break;
-	case APL_NAND:
-		if ((numL != 0 && numL != 1) || (numR != 0 && numR != 1))
-			EvlError(EE_DOMAIN);
-		res = !(numL && numR);
-		break;
-	case APL_NOR:
-		if ((numL != 0 && numL != 1) || (numR != 0 && numR != 1))
-			EvlError(EE_DOMAIN);
-		res = !(numL || numR);
-		break;
-	case APL_LT_OR_EQUAL:
-		res = numL <= numR;
-		break;
-	case APL_NOT_EQUAL:
-		res = numL != numR;
-		break;
-	case APL_GT_OR_EQUAL:
-		res = numL >= numR;
-		break;
+	case APL_CIRCLE:		return MathPiTimes;
+	case APL_MINUS:			return MathNeg;
+	case APL_STAR:			return MathKernels[MATH_EXP];
+	case APL_STILE:			return MathAbs;
+	case APL_CIRCLE_STAR:	return MathKernels[MATH_LOG];
+	case APL_UP_STILE:		return MathCeil;
+	case APL_DOWN_STILE:	return MathFloor;
+	case APL_TIMES:			return MathSignum;	// Sign
+	case APL_DIV:			return MathRecip;	// Inverse
 	}
 
-	return res;
+	return NULL;
 }
 
-static double EvlCircularFun(int fun, double arg)
+// ○ selects its function from the left argument: only once
+// when that is a scalar, for every element otherwise
+static void KernCircleSA(double *pz, double *px, double *py, int n)
 {
-	switch (fun) {
-	case -7:	// Inverse hyperbolic tangent (1>|arg)
-		if (arg > -1.0 && arg < 1.0)
-			return atanh(arg);
-		break;
-	case -6:	// Inverse hyperbolic cosine (arg≥1)
-		if (arg >= 1.0)
-			return acosh(arg);
-		break;
-	case -5:	// Inverse hyperbolic sine
-		return asinh(arg);
-	case -4:	// Sqrt(-1 + arg^2) (1≤|arg)
-		if (arg <= -1.0 || arg >= 1.0)
-			return sqrt(-1.0 + arg * arg);
-		break;
-	case -3:	// Arc tangent
-		return atan(arg);
-	case -2:	// Arc cosine (1≥|arg)
-		if (arg >= -1.0 && arg <= 1.0)
-			return acos(arg);
-		break;
-	case -1:	// Arc sine (1≥|arg)
-		if (arg >= -1.0 && arg <= 1.0)
-			return asin(arg);
-		break;
-	case 0:		// Sqrt(1 - arg^2) ((|arg)≤1)
-		if (arg >= -1.0 && arg <= 1.0)
-			return sqrt(1.0 - arg * arg);
-		break;
-	case 1:		// Sine
-		return sin(arg);
-	case 2:		// Cosine
-		return cos(arg);
-	case 3:		// Tangent
-		return tan(arg);
-	case 4:		// Sqrt(1 + arg^2)
-		return sqrt(1.0 + arg * arg);
-	case 5:		// Hyperbolic sine
-		return sinh(arg);
-	case 6:		// Hyperbolic cosine
-		return cosh(arg);
-	case 7:		// Hyperbolic tanget
-		return tanh(arg);
-	}
+	CircleKernel((int)*px)(pz, py, n);
+}
 
-	EvlError(EE_DOMAIN);
-	return 0;	// Not reached
+static void KernCircleAS(double *pz, double *px, double *py, int n)
+{
+	for (int i = 0; i < n; ++i)
+		CircleKernel((int)px[i])(pz + i, py, 1);
 }
 
-static void EvlDyadicStrFun(int fun)
+static void KernCircleAA(double *pz, double *px, double *py, int n)
 {
-	ARRAYINFO L;
-	ARRAYINFO R;
-	char *psrcL, *psrcR;
-	double *pnew;
-	int stepL, stepR;
-	int nelem;
+	for (int i = 0; i < n; ++i)
+		CircleKernel((int)px[i])(pz + i, py + i, 1);
+}
 
-	ArrayInfo(&L);
-	POP(poprTop);
-	ArrayInfo(&R);
+static double KernCircleR(double *px, int n)
+{
+	double y = px[n - 1];
 
-	nelem = DyadicConformable(&L, &R, poprTop);
+	for (int i = n - 2; i >= 0; --i)
+		CircleKernel((int)px[i])(&y, &y, 1);
 
-	psrcL = L.vptr;
-	stepL = L.step;
-	psrcR = R.vptr;
-	stepR = R.step;
+	return y;
+}
+
+// Dyadic scalar kernels
+//
+// Every scalar function has three kernels that apply it to n pairs of
+// doubles, one for each shape class of the arguments: scalar-array (SA),
+// array-scalar (AS) and array-array (AA). A fourth kernel (R) reduces n
+// doubles from right to left. Domain errors are only collected inside
+// the loops and raised at the end, so that the loops have no exits.
+// The kernels are the only place where these functions are evaluated.
+// EvlInitKernels() replaces some of them by vector versions at startup.
+
+#define	KERN_CLASS(stepL,stepR)	\
+	((stepL) ? ((stepR) ? KERN_AA : KERN_AS) : ((stepR) ? KERN_SA : KERN_AA))
+
+// x and y are the left and right arguments; 'bad' is true when
+// they are not in the domain of the function, error 'err'
+#define	NUM_KERNEL(name, expr, bad, err)						\
+static void name##SA(double *pz, double *px, double *py, int n)	\
+{																\
+	double x = *px, y;											\
+	int fail = 0;												\
+	for (int i = 0; i < n; ++i) {								\
+		y = py[i];												\
+		fail |= (bad);											\
+		pz[i] = (expr);											\
+	}															\
+	if (fail)													\
+		EvlError(err);											\
+}																\
+static void name##AS(double *pz, double *px, double *py, int n)	\
+{																\
+	double x, y = *py;											\
+	int fail = 0;												\
+	for (int i = 0; i < n; ++i) {								\
+		x = px[i];												\
+		fail |= (bad);											\
+		pz[i] = (expr);											\
+	}															\
+	if (fail)													\
+		EvlError(err);											\
+}																\
+static void name##AA(double *pz, double *px, double *py, int n)	\
+{																\
+	double x, y;												\
+	int fail = 0;												\
+	for (int i = 0; i < n; ++i) {								\
+		x = px[i];												\
+		y = py[i];												\
+		fail |= (bad);											\
+		pz[i] = (expr);											\
+	}															\
+	if (fail)													\
+		EvlError(err);											\
+}																\
+static double name##R(double *px, int n)						\
+{																\
+	double x, y = px[n - 1];									\
+	int fail = 0;												\
+	for (int i = n - 2; i >= 0; --i) {							\
+		x = px[i];												\
+		fail |= (bad);											\
+		y = (expr);												\
+	}															\
+	if (fail)													\
+		EvlError(err);											\
+	return y;													\
+}
 
-	pnew = DoubleAlloc(poprTop, nelem);
+// Both arguments must be 0 or 1
+#define	NOT_BOOL(x,y)	((((x) != 0) & ((x) != 1)) | (((y) != 0) & ((y) != 1)))
+
+NUM_KERNEL(KernMax,		max(x, y),					0,					0)
+NUM_KERNEL(KernMin,		min(x, y),					0,					0)
+NUM_KERNEL(KernPlus,	x + y,						0,					0)
+NUM_KERNEL(KernMinus,	x - y,						0,					0)
+NUM_KERNEL(KernTimes,	x * y,						0,					0)
+NUM_KERNEL(KernDiv,		x / y,						y == 0,				EE_DIVIDE_BY_ZERO)
+NUM_KERNEL(KernBinom,	Binomial(x, y),				0,					0)
+NUM_KERNEL(KernResidue,	x != 0 ? fmod(y, x) : y,	(x == 0) & (y < 0),	EE_DOMAIN)
+NUM_KERNEL(KernPower,	pow(x, y),					0,					0)
+NUM_KERNEL(KernAnd,		(x != 0) & (y != 0),		NOT_BOOL(x, y),		EE_DOMAIN)
+NUM_KERNEL(KernOr,		(x != 0) | (y != 0),		NOT_BOOL(x, y),		EE_DOMAIN)
+NUM_KERNEL(KernNand,	!((x != 0) & (y != 0)),		NOT_BOOL(x, y),		EE_DOMAIN)
+NUM_KERNEL(KernNor,		!((x != 0) | (y != 0)),		NOT_BOOL(x, y),		EE_DOMAIN)
+NUM_KERNEL(KernLt,		x < y,						0,					0)
+NUM_KERNEL(KernLe,		x <= y,						0,					0)
+NUM_KERNEL(KernEq,		x == y,						0,					0)
+NUM_KERNEL(KernGe,		x >= y,						0,					0)
+NUM_KERNEL(KernGt,		x > y,						0,					0)
+NUM_KERNEL(KernNe,		x != y,						0,					0)
+
+// Folds of associative functions with FOLD_LANES accumulators. Lane j
+// folds elements j, j+8, j+16... from left to right, then the lanes are
+// combined as in a vector register (j with j+4, then j with j+2...) and
+// the elements left over are folded one at a time. The vector versions
+// in simd.c do the same operations, so they give the same results.
+// Short arguments are folded from right to left by the R kernels.
+#define	FOLD_LANES		8
+#define	FOLD_BLOCK		256		// Elements folded before combining pairwise
+#define	FOLD_ROWS		8		// Rows folded before combining pairwise
+
+#define	ACC_FOLD(name, expr)									\
+static double name##F(double *px, int n)						\
+{																\
+	double acc[FOLD_LANES], x, y;								\
+	int i, j;													\
+	if (n < 2 * FOLD_LANES)										\
+		return name##R(px, n);									\
+	for (j = 0; j < FOLD_LANES; ++j)							\
+		acc[j] = px[j];											\
+	for (i = FOLD_LANES; i + FOLD_LANES <= n; i += FOLD_LANES)	\
+		for (j = 0; j < FOLD_LANES; ++j) {						\
+			x = acc[j];											\
+			y = px[i + j];										\
+			acc[j] = (expr);									\
+		}														\
+	for (int w = FOLD_LANES / 2; w; w /= 2)						\
+		for (j = 0; j < w; ++j) {								\
+			x = acc[j];											\
+			y = acc[j + w];										\
+			acc[j] = (expr);									\
+		}														\
+	for (x = acc[0]; i < n; ++i) {								\
+		y = px[i];												\
+		x = (expr);												\
+	}															\
+	return x;													\
+}
 
-	TYPE(poprTop) = TNUM;
+ACC_FOLD(KernMax,	max(x, y))
+ACC_FOLD(KernMin,	min(x, y))
+ACC_FOLD(KernPlus,	x + y)
+ACC_FOLD(KernTimes,	x * y)
+
+#define	KERNELS(name)	{ name##SA, name##AS, name##AA }
+
+// Indexed by function token and shape class
+static NUMKERNEL NumKernels[][3] = {
+	[APL_CIRCLE]		= KERNELS(KernCircle),
+	[APL_UP_STILE]		= KERNELS(KernMax),
+	[APL_DOWN_STILE]	= KERNELS(KernMin),
+	[APL_PLUS]			= KERNELS(KernPlus),
+	[APL_MINUS]			= KERNELS(KernMinus),
+	[APL_TIMES]			= KERNELS(KernTimes),
+	[APL_DIV]			= KERNELS(KernDiv),
+	[APL_EXCL_MARK]		= KERNELS(KernBinom),
+	[APL_STILE]			= KERNELS(KernResidue),
+	[APL_STAR]			= KERNELS(KernPower),
+	[APL_AND]			= KERNELS(KernAnd),
+	[APL_OR]			= KERNELS(KernOr),
+	[APL_NAND]			= KERNELS(KernNand),
+	[APL_NOR]			= KERNELS(KernNor),
+	[APL_LESS_THAN]		= KERNELS(KernLt),
+	[APL_LT_OR_EQUAL]	= KERNELS(KernLe),
+	[APL_EQUAL]			= KERNELS(KernEq),
+	[APL_GT_OR_EQUAL]	= KERNELS(KernGe),
+	[APL_GREATER_THAN]	= KERNELS(KernGt),
+	[APL_NOT_EQUAL]		= KERNELS(KernNe),
+};
+
+// Indexed by function token
+static NUMFOLD NumFolds[] = {
+	[APL_CIRCLE]		= KernCircleR,
+	[APL_UP_STILE]		= KernMaxF,
+	[APL_DOWN_STILE]	= KernMinF,
+	[APL_PLUS]			= KernPlusF,
+	[APL_MINUS]			= KernMinusR,
+	[APL_TIMES]			= KernTimesF,
+	[APL_DIV]			= KernDivR,
+	[APL_EXCL_MARK]		= KernBinomR,
+	[APL_STILE]			= KernResidueR,
+	[APL_STAR]			= KernPowerR,
+	[APL_AND]			= KernAndR,
+	[APL_OR]			= KernOrR,
+	[APL_NAND]			= KernNandR,
+	[APL_NOR]			= KernNorR,
+	[APL_LESS_THAN]		= KernLtR,
+	[APL_LT_OR_EQUAL]	= KernLeR,
+	[APL_EQUAL]			= KernEqR,
+	[APL_GT_OR_EQUAL]	= KernGeR,
+	[APL_GREATER_THAN]	= KernGtR,
+	[APL_NOT_EQUAL]		= KernNeR,
+};
+
+#define	NUM_FUNS	(int)(sizeof(NumKernels) / sizeof(NumKernels[0]))
+
+// Integer kernels of some functions, all vector versions. Where there
+// is none, integers are handled by EvlDyadicScalarIntFun().
+static INTKERNEL IntKernels[NUM_FUNS][3];
 
+// Install the vector kernels supported by this CPU
+void EvlInitKernels(void)
+{
+	for (int fun = 0; fun < NUM_FUNS; ++fun)
+		if (NumKernels[fun][0])
+			SimdKernels(fun, NumKernels[fun], IntKernels[fun], &NumFolds[fun]);
+
+	SimdMathKernels(MathKernels);
+}
+
+// Kernel of a dyadic scalar function for a shape class
+static NUMKERNEL NumKernel(int fun, int class)
+{
+	if (fun >= NUM_FUNS || !NumKernels[fun][0])
+		EvlError(EE_DOMAIN);
+
+	return NumKernels[fun][class];
+}
+
+// Fold (reduction) kernel of a dyadic scalar function
+static NUMFOLD NumFold(int fun)
+{
+	if (fun >= sizeof(NumFolds) / sizeof(NumFolds[0]) || !NumFolds[fun])
+		EvlError(EE_DOMAIN);
+
+	return NumFolds[fun];
+}
+
+// Functions whose reductions may be split into parts
+static int IsAssocFun(int fun)
+{
 	switch (fun) {
-	case APL_EQUAL:
-		while (nelem--) {
-			*pnew++ = *psrcL == *psrcR;
-			psrcL += stepL;
-			psrcR += stepR;
-		}
-		break;
-	case APL_NOT_EQUAL:
-		while (nelem--) {
-			*pnew++ = *psrcL != *psrcR;
-			psrcL += stepL;
-			psrcR += stepR;
-		}
-		break;
+	case APL_PLUS:
+	case APL_TIMES:
+	case APL_UP_STILE:
+	case APL_DOWN_STILE:
+	case APL_AND:
+	case APL_OR:
+		return 1;
 	}
+
+	return 0;
 }
 
-static void EvlDyadicNumFun(int fun)
+// Fold n elements. Associative functions fold blocks of FOLD_BLOCK
+// elements and combine the results pairwise, which keeps the rounding
+// errors of +/ small. The halves are split at a power of two, so the
+// results of aligned blocks (or chunks) can be combined later by
+// FoldPartials() with the same result.
+static double FoldVector(int fun, NUMFOLD fold, double *px, int n)
 {
-	ARRAYINFO L;
-	ARRAYINFO R;
-	double *psrcL, *psrcR;
-	double *pnew;
-	int stepL, stepR;
-	int nelem;
+	double half[2];
+	int m;
 
-	ArrayInfo(&L);
-	POP(poprTop);
-	ArrayInfo(&R);
+	if (n <= FOLD_BLOCK || !IsAssocFun(fun))
+		return fold(px, n);
 
-	nelem = DyadicConformable(&L, &R, poprTop);
+	for (m = FOLD_BLOCK; m * 2 < n; m *= 2)
+		;
+	half[0] = FoldVector(fun, fold, px, m);
+	half[1] = FoldVector(fun, fold, px + m, n - m);
+	return fold(half, 2);
+}
 
-	psrcL = L.vptr;
-	stepL = L.step;
-	psrcR = R.vptr;
-	stepR = R.step;
+// Combine the results of n consecutive blocks like FoldVector()
+static double FoldPartials(NUMFOLD fold, double *px, int n)
+{
+	double half[2];
+	int m;
 
-	pnew = DoubleAlloc(poprTop, nelem);
-	TYPE(poprTop) = TNUM;
+	if (n == 1)
+		return px[0];
 
-	while (nelem--) {
-		*pnew++ = EvlDyadicScalarNumFun(fun, *psrcL, *psrcR);
-		psrcL += stepL;
-		psrcR += stepR;
+	for (m = 1; m * 2 < n; m *= 2)
+		;
+	half[0] = FoldPartials(fold, px, m);
+	half[1] = FoldPartials(fold, px + m, n - m);
+	return fold(half, 2);
+}
+
+// Fold n rows of len (at most FOLD_BLOCK) elements that are stride
+// elements apart. Associative functions fold FOLD_ROWS rows at a time
+// and combine them pairwise, like FoldVector().
+static void FoldColumns(NUMKERNEL kernel, int assoc, double *pz, double *pf,
+	int n, int stride, int len)
+{
+	double tmp[FOLD_BLOCK];
+	int m;
+
+	if (assoc && n > FOLD_ROWS) {
+		for (m = FOLD_ROWS; m * 2 < n; m *= 2)
+			;
+		FoldColumns(kernel, assoc, pz, pf, m, stride, len);
+		FoldColumns(kernel, assoc, tmp, pf + m * stride, n - m, stride, len);
+		kernel(pz, pz, tmp, len);
+		return;
 	}
+
+	memcpy(pz, pf + (n - 1) * stride, len * sizeof(double));
+	for (int k = n - 2; k >= 0; --k)
+		kernel(pz, pf + k * stride, pz, len);
 }
 
-static void EvlDyadicMixFun(fun)
+// Arguments of a kernel that is run by several threads (see PoolFor)
+typedef struct {
+	NUMKERNEL	kernel;		// Dyadic kernel
+	MATHKERNEL	math;		// or monadic kernel
+	NUMFOLD		fold;		// or fold kernel
+	int			fun;		// Function of a reduction
+	double		*pz;		// Result
+	double		*px;		// Left (or only) argument
+	double		*py;		// Right argument
+	double		*pparts;	// Results of chunks of a scan
+	int			stepx;		// Steps of the arguments
+	int			stepy;
+	int			n;			// Length of rows
+	int			stride;		// and distance between their elements
+} KERNTASK;
+
+static void KernTask(void *parg, int start, int end)
 {
-	ARRAYINFO L;
-	ARRAYINFO R;
-	double *pnew;
-	int nelem;
+	KERNTASK *pt = parg;
 
-	// Mixed types. Only = and ≠ are possible and will return all 0's
-	if (fun != APL_EQUAL && fun != APL_NOT_EQUAL)
-		EvlError(EE_DOMAIN);
+	if (pt->math)
+		pt->math(pt->pz + start, pt->px + start, end - start);
+	else
+		pt->kernel(pt->pz + start, pt->px + start * pt->stepx,
+			pt->py + start * pt->stepy, end - start);
+}
 
-	ArrayInfo(&L);
-	POP(poprTop);
-	ArrayInfo(&R);
+// Apply a dyadic kernel to n elements
+static void ParNumKernel(NUMKERNEL kernel, double *pz, double *px, int stepx,
+	double *py, int stepy, int n)
+{
+	KERNTASK task = { .kernel = kernel, .pz = pz, .px = px, .py = py,
+		.stepx = stepx, .stepy = stepy };
 
-	nelem = DyadicConformable(&L, &R, poprTop);
-	pnew = DoubleAlloc(poprTop, nelem);
-	TYPE(poprTop) = TNUM;
-	// All zeros
-	memset(pnew, 0, nelem * sizeof(double));
+	PoolFor(KernTask, &task, n, POOL_GRAIN);
 }
 
-static void EvlDyadicFun(int fun, int axis, int axis_type)
+// Apply a monadic kernel to n elements
+static void ParMathKernel(MATHKERNEL math, double *pz, double *px, int n)
 {
-	int typL, typR;
-	int rankL, rankR, rank;
+	KERNTASK task = { .math = math, .pz = pz, .px = px };
 
-	// Handle non-scalar functions first
-	switch (fun) {
-	case APL_EPSILON:	// A ∊ B
-		FunMembership();
-		return;
-	case APL_IOTA:		// V ⍳ A
-		FunIndexOf();
+	PoolFor(KernTask, &task, n, POOL_GRAIN);
+}
+
+// Rolls of more than one chunk draw a single number from the main
+// generator, from which each chunk seeds its own
+typedef struct {
+	double		*pz;
+	double		*px;
+	uint64_t	base;
+} ROLLTASK;
+
+static void RollTask(void *parg, int start, int end)
+{
+	ROLLTASK *pt = parg;
+	RANDGEN gen;
+
+	RandSplit(&gen, pt->base, start / POOL_GRAIN);
+	RandRoll(&gen, pt->pz + start, pt->px + start, end - start);
+}
+
+// ?px for n elements
+static void ParRoll(double *pz, double *px, int n)
+{
+	ROLLTASK task = { .pz = pz, .px = px };
+
+	if (n <= POOL_GRAIN) {
+		RandRoll(&g_rand, pz, px, n);
 		return;
-	case APL_RHO:		// V ⍴ A
-		if (axis_type != AXIS_DEFAULT)
-			EvlError(EE_SYNTAX_ERROR);
+	}
+
+	task.base = RandNext(&g_rand);
+	PoolFor(RollTask, &task, n, POOL_GRAIN);
+}
+
+// Fold rows start..end-1
+static void FoldRowsTask(void *parg, int start, int end)
+{
+	KERNTASK *pt = parg;
+
+	for (int i = start; i < end; ++i)
+		pt->pz[i] = FoldVector(pt->fun, pt->fold, pt->px + i * pt->n, pt->n);
+}
+
+// Fold one chunk of a vector
+static void FoldChunkTask(void *parg, int start, int end)
+{
+	KERNTASK *pt = parg;
+
+	pt->pz[start / POOL_GRAIN] = FoldVector(pt->fun, pt->fold, pt->px + start, end - start);
+}
+
+// Elements start..end-1 of a reduction along an axis other than the
+// last. Each block of stride elements of the result combines n rows,
+// which are read FOLD_BLOCK contiguous elements at a time.
+static void FoldAxisTask(void *parg, int start, int end)
+{
+	KERNTASK *pt = parg;
+	int n = pt->n, stride = pt->stride;
+	int assoc = IsAssocFun(pt->fun);
+
+	for (int i = start, j; i < end; i = j) {
+		int blk = i / stride;
+		double *pf = pt->px + blk * n * stride + (i - blk * stride);
+
+		j = min(end, (blk + 1) * stride);
+		for (int k = i; k < j; k += FOLD_BLOCK)
+			FoldColumns(pt->kernel, assoc, pt->pz + k, pf + (k - i), n, stride,
+				min(j - k, FOLD_BLOCK));
+	}
+}
+
+// Scan n elements that are stride elements apart from left to right
+// with an associative function. Returns the last element of the result.
+static double ScanRun(int fun, double *pz, double *px, int n, int stride)
+{
+	double accum = px[0], arg;
+	int fail = 0;
+
+	pz[0] = accum;
+	for (int k = 1; k < n; ++k) {
+		arg = px[k * stride];
+		switch (fun) {
+		case APL_UP_STILE:
+			accum = max(accum, arg);
+			break;
+		case APL_DOWN_STILE:
+			accum = min(accum, arg);
+			break;
+		case APL_PLUS:
+			accum += arg;
+			break;
+		case APL_TIMES:
+			accum *= arg;
+			break;
+		case APL_AND:
+		case APL_OR:
+			fail |= (accum != 0 && accum != 1) | (arg != 0 && arg != 1);
+			accum = fun == APL_AND ? accum && arg : accum || arg;
+			break;
+		}
+		pz[k * stride] = accum;
+	}
+
+	if (fail)
+		EvlError(EE_DOMAIN);
+
+	return accum;
+}
+
+// Scan rows start..end-1 of n contiguous elements
+static void ScanRowsTask(void *parg, int start, int end)
+{
+	KERNTASK *pt = parg;
+
+	for (int i = start; i < end; ++i)
+		ScanRun(pt->fun, pt->pz + i * pt->n, pt->px + i * pt->n, pt->n, 1);
+}
+
+// First pass of the scan of a long vector: scan one chunk on its own
+static void ScanChunkTask(void *parg, int start, int end)
+{
+	KERNTASK *pt = parg;
+
+	pt->pparts[start / POOL_GRAIN] =
+		ScanRun(pt->fun, pt->pz + start, pt->px + start, end - start, 1);
+}
+
+// Second pass: combine a chunk with the scan of the chunks before it
+static void ScanFixTask(void *parg, int start, int end)
+{
+	KERNTASK *pt = parg;
+	double *pz = pt->pz + start;
+	double offset;
+	int c = start / POOL_GRAIN;
+
+	if (!c)
+		return;
+
+	offset = pt->pparts[c - 1];
+	switch (pt->fun) {
+	case APL_AND:
+	case APL_OR:
+		// The chunk is unchanged or all 0's (∧) or all 1's (∨)
+		if (offset != (pt->fun == APL_AND))
+			for (int i = 0; i < end - start; ++i)
+				pz[i] = offset;
+		break;
+	default:
+		pt->kernel(pz, &offset, pz, end - start);
+		break;
+	}
+}
+
+// Scan a vector of n elements in chunks: each chunk is scanned on its
+// own, then the scan of the last elements of the chunks gives what has
+// to be combined with the chunks that follow. The chunks depend only on
+// n, so the result is the same with any number of threads.
+static void ScanVector(KERNTASK *pt, int n)
+{
+	int nchunks;
+
+	nchunks = PoolFor(ScanChunkTask, pt, n, POOL_GRAIN);
+	ScanRun(pt->fun, pt->pparts, pt->pparts, nchunks, 1);
+	PoolFor(ScanFixTask, pt, n, POOL_GRAIN);
+}
+
+// Elements start..end-1 of a scan along an axis other than the last.
+// Each block of stride elements is scanned down n rows, FOLD_BLOCK
+// contiguous elements at a time, combining each row with the previous
+// row of the result.
+static void ScanAxisTask(void *parg, int start, int end)
+{
+	KERNTASK *pt = parg;
+	int n = pt->n, stride = pt->stride;
+
+	for (int i = start, j; i < end; i = j) {
+		int blk = i / stride;
+		int off = blk * n * stride + (i - blk * stride);
+
+		j = min(end, (blk + 1) * stride);
+		for (int k = i; k < j; k += FOLD_BLOCK) {
+			int len = min(j - k, FOLD_BLOCK);
+			double *pz = pt->pz + off + (k - i);
+			double *px = pt->px + off + (k - i);
+
+			memcpy(pz, px, len * sizeof(double));
+			for (int r = 1; r < n; ++r)
+				pt->kernel(pz + r * stride, pz + (r - 1) * stride,
+					px + r * stride, len);
+		}
+	}
+}
+
+// Apply a dyadic scalar function to a single pair of numbers
+static inline double EvlDyadicScalarNumFun(int fun, double numL, double numR)
+{
+	double res;
+
+	NumKernel(fun, KERN_AA)(&res, &numL, &numR, 1);
+
+	return res;
+}
+
+// Integer version of EvlDyadicScalarNumFun()
+// Returns 0 if the result is not an integer or doesn't fit in one.
+static inline int EvlDyadicScalarIntFun(int fun, aplint numL, aplint numR, aplint *pres)
+{
+	switch (fun) {
+	case APL_UP_STILE:
+		*pres = max(numL, numR);
+		break;
+	case APL_DOWN_STILE:
+		*pres = min(numL, numR);
+		break;
+	case APL_PLUS:
+		return !__builtin_add_overflow(numL, numR, pres);
+	case APL_MINUS:
+		return !__builtin_sub_overflow(numL, numR, pres);
+	case APL_TIMES:
+		return !__builtin_mul_overflow(numL, numR, pres);
+	case APL_DIV:
+		if (!numR)
+			EvlError(EE_DIVIDE_BY_ZERO);
+		if (numR == -1)	// Avoid INT64_MIN / -1
+			return !__builtin_sub_overflow(0, numL, pres);
+		if (numL % numR)
+			return 0;	// Fraction
+		*pres = numL / numR;
+		break;
+	case APL_STILE:
+		if (numL == -1)	// Avoid INT64_MIN % -1
+			*pres = 0;
+		else if (numL != 0)
+			*pres = numR % numL;	// Same sign as fmod()
+		else {
+			if (numR >= 0)
+				*pres = numR;
+			else
+				EvlError(EE_DOMAIN);
+		}
+		break;
+	case APL_LESS_THAN:
+		*pres = numL < numR;
+		break;
+	case APL_EQUAL:
+		*pres = numL == numR;
+		break;
+	case APL_GREATER_THAN:
+		*pres = numL > numR;
+		break;
+	case APL_LT_OR_EQUAL:
+		*pres = numL <= numR;
+		break;
+	case APL_NOT_EQUAL:
+		*pres = numL != numR;
+		break;
+	case APL_GT_OR_EQUAL:
+		*pres = numL >= numR;
+		break;
+	case APL_AND:
+	case APL_OR:
+	case APL_NAND:
+	case APL_NOR:
+		if ((numL != 0 && numL != 1) || (numR != 0 && numR != 1))
+			EvlError(EE_DOMAIN);
+		switch (fun) {
+		case APL_AND:	*pres = numL & numR;		break;
+		case APL_OR:	*pres = numL | numR;		break;
+		case APL_NAND:	*pres = !(numL & numR);		break;
+		case APL_NOR:	*pres = !(numL | numR);		break;
+		}
+		break;
+	default:
+		return 0;
+	}
+
+	return 1;
+}
+
+// Functions that EvlDyadicScalarIntFun() knows about
+static int IsIntFun(int fun)
+{
+	switch (fun) {
+	case APL_UP_STILE:
+	case APL_DOWN_STILE:
+	case APL_PLUS:
+	case APL_MINUS:
+	case APL_TIMES:
+	case APL_DIV:
+	case APL_STILE:
+	case APL_LESS_THAN:
+	case APL_EQUAL:
+	case APL_GREATER_THAN:
+	case APL_LT_OR_EQUAL:
+	case APL_NOT_EQUAL:
+	case APL_GT_OR_EQUAL:
+	case APL_AND:
+	case APL_OR:
+	case APL_NAND:
+	case APL_NOR:
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+// Functions that always return 0 or 1
+static int IsBoolFun(int fun)
+{
+	switch (fun) {
+	case APL_LESS_THAN:
+	case APL_EQUAL:
+	case APL_GREATER_THAN:
+	case APL_LT_OR_EQUAL:
+	case APL_NOT_EQUAL:
+	case APL_GT_OR_EQUAL:
+	case APL_AND:
+	case APL_OR:
+	case APL_NAND:
+	case APL_NOR:
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+// Dyadic functions applied element by element
+static int IsScalarFun(int fun)
+{
+	switch (fun) {
+	case APL_CIRCLE:
+	case APL_EXCL_MARK:
+	case APL_STAR:
+	case APL_CIRCLE_STAR:
+		return TRUE;
+	}
+
+	return IsIntFun(fun);
+}
+
+// Element i of an integer array of any width
+static inline aplint IntElem(void *ptr, int width, int i)
+{
+	switch (width) {
+	case 1:		return ((int8_t *)ptr)[i];
+	case 2:		return ((int16_t *)ptr)[i];
+	case 4:		return ((int32_t *)ptr)[i];
+	default:	return ((aplint *)ptr)[i];
+	}
+}
+
+static void EvlDyadicStrFun(int fun)
+{
+	ARRAYINFO L;
+	ARRAYINFO R;
+	char *psrcL, *psrcR;
+	aplbits *pnew;
+	int stepL, stepR;
+	int nelem;
+
+	if (fun != APL_EQUAL && fun != APL_NOT_EQUAL)
+		EvlError(EE_DOMAIN);
+
+	ArrayInfo(&L);
+	POP(poprTop);
+	ArrayInfo(&R);
+
+	nelem = DyadicConformable(&L, &R, poprTop);
+
+	psrcL = L.vptr;
+	stepL = L.step;
+	psrcR = R.vptr;
+	stepR = R.step;
+
+	if (ISSCALAR(poprTop)) {
+		TYPE(poprTop) = TINT;
+		VINT(poprTop) = (*psrcL == *psrcR) ^ (fun == APL_NOT_EQUAL);
+		return;
+	}
+
+	pnew = BoolAlloc(poprTop, nelem);
+
+	TYPE(poprTop) = TBOOL;
+
+	for (int i = 0; i < nelem; ++i) {
+		if ((*psrcL == *psrcR) ^ (fun == APL_NOT_EQUAL))
+			pnew[i >> 6] |= (aplbits)1 << (i & 63);
+		psrcL += stepL;
+		psrcR += stepR;
+	}
+}
+
+// Two numeric scalars, the usual case in loops. The result is written
+// to the internal storage of the descriptor of the right argument,
+// without setting up any ARRAYINFO.
+// Returns 0 if the arguments or the function don't qualify.
+static int EvlDyadicScalarScalar(int fun)
+{
+	DESC *pL = poprTop;
+	DESC *pR = poprTop + 1;
+	double numL, numR;
+	aplint res;
+
+	if (!IsScalarFun(fun))
+		return 0;
+
+	if (TYPE(pL) == TINT && TYPE(pR) == TINT) {
+		aplint intL = *(aplint *)VPTR(pL);
+		aplint intR = *(aplint *)VPTR(pR);
+
+		if (IsIntFun(fun) && EvlDyadicScalarIntFun(fun, intL, intR, &res)) {
+			POP(poprTop);
+			TYPE(poprTop) = TINT;
+			VOFF(poprTop) = MINOFF;
+			VINT(poprTop) = res;
+			return 1;
+		}
+		numL = (double)intL;
+		numR = (double)intR;
+	} else if ((TYPE(pL) == TINT || TYPE(pL) == TNUM) &&
+		(TYPE(pR) == TINT || TYPE(pR) == TNUM)) {
+		numL = TYPE(pL) == TINT ? (double)*(aplint *)VPTR(pL) : *(double *)VPTR(pL);
+		numR = TYPE(pR) == TINT ? (double)*(aplint *)VPTR(pR) : *(double *)VPTR(pR);
+	} else
+		return 0;
+
+	numL = EvlDyadicScalarNumFun(fun, numL, numR);
+	POP(poprTop);
+	VOFF(poprTop) = MINOFF;
+	if (IsBoolFun(fun)) {
+		TYPE(poprTop) = TINT;
+		VINT(poprTop) = (aplint)numL;
+	} else {
+		TYPE(poprTop) = TNUM;
+		VNUM(poprTop) = numL;
+	}
+
+	return 1;
+}
+
+static void EvlDyadicNumFun(int fun)
+{
+	ARRAYINFO L;
+	ARRAYINFO R;
+	double *psrcL, *psrcR;
+	double *pnew;
+	int stepL, stepR;
+	int nelem, deadL, deadR;
+
+	ArrayInfo(&L);
+	POP(poprTop);
+	ArrayInfo(&R);
+
+	nelem = DyadicConformable(&L, &R, poprTop);
+
+	// Boolean results are packed
+	if (IsBoolFun(fun) && ISARRAY(poprTop)) {
+		EvlDyadicBoolFun(fun, &L, &R, nelem);
+		return;
+	}
+
+	// Try integer arithmetic first
+	if (ISINTEGER(L.type) && ISINTEGER(R.type) && IsIntFun(fun) &&
+		EvlDyadicIntFun(fun, &L, &R, nelem)) {
+		TYPE(poprTop) = TINT;
+		return;
+	}
+
+	// An array argument may receive the result if it dies here. Integers
+	// are converted in place; other arguments converted to doubles are
+	// new arrays. Arguments that share elements are left alone.
+	psrcL = L.vptr;
+	psrcR = R.vptr;
+	deadL = L.step && (L.type == TINT || L.type == TNUM) &&
+		IsDeadTemp(psrcL, nelem * sizeof(double), poprTop + 1);
+	deadR = R.step && (R.type == TINT || R.type == TNUM) &&
+		IsDeadTemp(psrcR, nelem * sizeof(double), poprTop + 1);
+	if (L.step && R.step && psrcL < psrcR + nelem && psrcR < psrcL + nelem)
+		deadL = deadR = 0;
+	if (deadL)
+		TempToDouble(&L);
+	if (deadR)
+		TempToDouble(&R);
+	InfoToDouble(&L);
+	InfoToDouble(&R);
+	deadL |= L.step && L.vptr != psrcL;
+	deadR |= R.step && R.vptr != psrcR;
+
+	psrcL = L.vptr;
+	stepL = L.step;
+	psrcR = R.vptr;
+	stepR = R.step;
+
+	if (IsBoolFun(fun)) {	// Scalar
+		TYPE(poprTop) = TINT;
+		VINT(poprTop) = (aplint)EvlDyadicScalarNumFun(fun, *psrcL, *psrcR);
+		return;
+	}
+
+	if (deadR || deadL) {
+		pnew = deadR ? psrcR : psrcL;
+		VOFF(poprTop) = WKSOFF(pnew);
+	} else
+		pnew = DoubleAlloc(poprTop, nelem);
+	TYPE(poprTop) = TNUM;
+
+	ParNumKernel(NumKernel(fun, KERN_CLASS(stepL, stepR)), pnew, psrcL, stepL, psrcR, stepR, nelem);
+}
+
+// Comparisons and logical functions with an array result
+static void EvlDyadicBoolFun(int fun, ARRAYINFO *pL, ARRAYINFO *pR, int nelem)
+{
+	aplbits *pdst = BoolAlloc(poprTop, nelem);
+	aplbits word;
+	aplint res;
+	int stepL, stepR;
+
+	TYPE(poprTop) = TBOOL;
+
+	// Both arguments packed: 64 elements at a time
+	if (pL->type == TBOOL) {
+		aplbits *psrcL = pL->vptr;
+		aplbits *psrcR = pR->vptr;
+		int nwords = BOOL_WORDS(nelem);
+
+		for (int i = 0; i < nwords; ++i) {
+			aplbits a = psrcL[i];
+			aplbits b = psrcR[i];
+			switch (fun) {
+			case APL_AND:			word = a & b;		break;
+			case APL_OR:			word = a | b;		break;
+			case APL_NAND:			word = ~(a & b);	break;
+			case APL_NOR:			word = ~(a | b);	break;
+			case APL_EQUAL:			word = ~(a ^ b);	break;
+			case APL_NOT_EQUAL:		word = a ^ b;		break;
+			case APL_LESS_THAN:		word = ~a & b;		break;
+			case APL_LT_OR_EQUAL:	word = ~a | b;		break;
+			case APL_GREATER_THAN:	word = a & ~b;		break;
+			case APL_GT_OR_EQUAL:	word = a | ~b;		break;
+			}
+			pdst[i] = word;
+		}
+		// Clear unused bits
+		if (nelem & 63)
+			pdst[nwords - 1] &= ((aplbits)1 << (nelem & 63)) - 1;
+		return;
+	}
+
+	if (!ISINTEGER(pL->type) || !ISINTEGER(pR->type)) {
+		InfoToDouble(pL);
+		InfoToDouble(pR);
+	}
+
+	stepL = pL->step;
+	stepR = pR->step;
+	word = 0;
+
+	if (ISINTEGER(pL->type) && pL->width == sizeof(aplint) &&
+		pR->width == sizeof(aplint) && IntKernels[fun][0]) {
+		// Same as doubles below
+		INTKERNEL kernel = IntKernels[fun][KERN_CLASS(stepL, stepR)];
+		aplint *psrcL = pL->vptr;
+		aplint *psrcR = pR->vptr;
+		aplint block[64];
+
+		for (int i = 0; i < nelem; i += 64) {
+			int n = min(nelem - i, 64);
+			kernel(block, psrcL + i * stepL, psrcR + i * stepR, n);
+			word = 0;
+			for (int j = 0; j < n; ++j)
+				word |= (aplbits)block[j] << j;
+			*pdst++ = word;
+		}
+		return;
+	} else if (ISINTEGER(pL->type)) {
+		for (int i = 0, iL = 0, iR = 0; i < nelem; ++i) {
+			EvlDyadicScalarIntFun(fun, IntElem(pL->vptr, pL->width, iL),
+				IntElem(pR->vptr, pR->width, iR), &res);
+			word |= (aplbits)res << (i & 63);
+			if ((i & 63) == 63) {
+				*pdst++ = word;
+				word = 0;
+			}
+			iL += stepL;
+			iR += stepR;
+		}
+	} else {
+		// Results are packed 64 at a time
+		NUMKERNEL kernel = NumKernel(fun, KERN_CLASS(stepL, stepR));
+		double *psrcL = pL->vptr;
+		double *psrcR = pR->vptr;
+		double block[64];
+
+		for (int i = 0; i < nelem; i += 64) {
+			int n = min(nelem - i, 64);
+			kernel(block, psrcL + i * stepL, psrcR + i * stepR, n);
+			word = 0;
+			for (int j = 0; j < n; ++j)
+				word |= (aplbits)(block[j] != 0) << j;
+			*pdst++ = word;
+		}
+		return;
+	}
+
+	if (nelem & 63)
+		*pdst = word;
+}
+
+// Integer arguments. Returns 0 if some element of the result
+// is not an integer; the caller then starts over with doubles.
+static int EvlDyadicIntFun(int fun, ARRAYINFO *pL, ARRAYINFO *pR, int nelem)
+{
+	aplint *pnew, small[8];
+	INTKERNEL kernel;
+	int stepL, stepR;
+	int iL, iR;
+
+	stepL = pL->step;
+	stepR = pR->step;
+
+	// Results are only written to the descriptor if all of them fit.
+	// Short results don't use the array stack, which is only released
+	// when control returns to immediate mode.
+	pnew = nelem <= 8 ? small : TempAlloc(sizeof(aplint), nelem);
+
+	// The common case of two 64-bit arguments gets its own loop,
+	// or a vector kernel
+	if (pL->width == sizeof(aplint) && pR->width == sizeof(aplint) &&
+		(kernel = IntKernels[fun][KERN_CLASS(stepL, stepR)]) != NULL) {
+		if (!kernel(pnew, pL->vptr, pR->vptr, nelem))
+			return 0;
+	} else if (pL->width == sizeof(aplint) && pR->width == sizeof(aplint)) {
+		aplint *psrcL = pL->vptr;
+		aplint *psrcR = pR->vptr;
+
+		for (int i = 0; i < nelem; ++i) {
+			if (!EvlDyadicScalarIntFun(fun, *psrcL, *psrcR, pnew + i))
+				return 0;
+			psrcL += stepL;
+			psrcR += stepR;
+		}
+	} else {
+		for (int i = iL = iR = 0; i < nelem; ++i) {
+			if (!EvlDyadicScalarIntFun(fun, IntElem(pL->vptr, pL->width, iL),
+					IntElem(pR->vptr, pR->width, iR), pnew + i))
+				return 0;
+			iL += stepL;
+			iR += stepR;
+		}
+	}
+
+	memcpy(IntAlloc(poprTop, nelem), pnew, nelem * sizeof(aplint));
+
+	return 1;
+}
+
+static void EvlDyadicMixFun(fun)
+{
+	ARRAYINFO L;
+	ARRAYINFO R;
+	aplbits *pnew;
+	int nelem;
+
+	// Mixed types. Only = and ≠ are possible and will return all 0's or 1's
+	if (fun != APL_EQUAL && fun != APL_NOT_EQUAL)
+		EvlError(EE_DOMAIN);
+
+	ArrayInfo(&L);
+	POP(poprTop);
+	ArrayInfo(&R);
+
+	nelem = DyadicConformable(&L, &R, poprTop);
+
+	if (ISSCALAR(poprTop)) {
+		TYPE(poprTop) = TINT;
+		VINT(poprTop) = fun == APL_NOT_EQUAL;
+		return;
+	}
+
+	pnew = BoolAlloc(poprTop, nelem);
+	TYPE(poprTop) = TBOOL;
+	if (fun == APL_NOT_EQUAL && nelem) {
+		int nwords = BOOL_WORDS(nelem);
+		memset(pnew, 0xff, nwords * sizeof(aplbits));
+		if (nelem & 63)
+			pnew[nwords - 1] = ((aplbits)1 << (nelem & 63)) - 1;
+	}
+}
+
+static void EvlDyadicFun(int fun, int axis, int axis_type)
+{
+	int typL, typR;
+	int rankL, rankR, rank;
+
+	if (ISSCALAR(poprTop) && ISSCALAR(poprTop + 1) && EvlDyadicScalarScalar(fun))
+		return;
+
+	// Only transpose, take and drop accept a view as right argument
+	ViewExpand(poprTop);
+	if (fun != APL_TRANSPOSE && fun != APL_UP_ARROW && fun != APL_DOWN_ARROW)
+		ViewExpand(poprTop + 1);
+
+	// Arithmetic progressions are expanded unless the result is
+	// another progression
+	if (TYPE(poprTop) == TAP || TYPE(poprTop + 1) == TAP) {
+		if (ApDyadicFun(fun, axis_type))
+			return;
+		IntWiden(poprTop);
+		IntWiden(poprTop + 1);
+	}
+
+	// Narrow integers are read directly only by the scalar functions
+	if (!IsScalarFun(fun)) {
+		IntWiden(poprTop);
+		IntWiden(poprTop + 1);
+	}
+
+	// Packed booleans are handled natively only as masks of compress
+	// and expand and by the logical functions when both arguments are packed
+	if (TYPE(poprTop) == TBOOL || TYPE(poprTop + 1) == TBOOL) {
+		switch (fun) {
+		case APL_SLASH:
+		case APL_SLASH_BAR:
+		case APL_BACKSLASH:
+		case APL_BACKSLASH_BAR:
+			BoolToInt(poprTop + 1);
+			break;
+		default:
+			if (!IsBoolFun(fun) || TYPE(poprTop) != TYPE(poprTop + 1)) {
+				BoolToInt(poprTop);
+				BoolToInt(poprTop + 1);
+			}
+			break;
+		}
+	}
+
+	// Handle non-scalar functions first
+	switch (fun) {
+	case APL_EPSILON:	// A ∊ B
+		FunMembership();
+		return;
+	case APL_TILDE:		// V ~ A
+		FunWithout();
+		return;
+	case APL_IOTA:		// V ⍳ A
+		FunIndexOf();
+		return;
+	case APL_IOTA_UNDERBAR:	// V ⍸ A
+		FunIntervalIndex();
+		return;
+	case APL_RHO:		// V ⍴ A
+		if (axis_type != AXIS_DEFAULT)
+			EvlError(EE_SYNTAX_ERROR);
 		FunReshape();
 		return;
 	case APL_UP_ARROW:	// A ↑ B
@@ -1208,7 +2364,7 @@ static void EvlDyadicFun(int fun, int axis, int axis_type)
 	typR = TYPE(SECOND(poprTop));
 
 	// Numeric functions
-	if (typL == TNUM && typR == TNUM) {
+	if ((typL & (TINT|TNUM)) && (typR & (TINT|TNUM))) {
 		EvlDyadicNumFun(fun);
 		return;
 	}
@@ -1222,8 +2378,308 @@ static void EvlDyadicFun(int fun, int axis, int axis_type)
 	EvlDyadicMixFun(fun);
 }
 
+// Fusion of scalar function chains
+//
+// An expression like +/1+2×X*2 on a long array X would otherwise
+// build an intermediate array for every function. When the value on
+// top of the stack is a double array, FuseChain() looks ahead for a
+// chain of scalar functions whose left arguments are numbers or
+// variables and applies the whole chain FUSE_BLOCK elements at a time,
+// so that the intermediate values stay in the cache. A comparison or
+// logical function may end the chain, as may a reduction of a vector.
+// Long chains are split among the threads (see PoolFor).
+#define	FUSE_MAXSTEPS	16		// Longer chains are done in pieces
+#define	FUSE_MINELEM	64		// Shorter arrays are not worth it
+#define	FUSE_BLOCK		FOLD_BLOCK	// Elements per pass through the chain
+
+typedef struct {
+	NUMKERNEL	dyadic;		// Kernel of a dyadic function
+	MATHKERNEL	monadic;	// Kernel of a monadic function
+	NUMFOLD		fold;		// Kernel of a trailing reduction
+	char		*pcode;		// Position of the function in the code
+	char		*pnext;		// Position after the function (and argument)
+	double		*parg;		// Left argument
+	double		arg;		// Value of a scalar left argument
+	int			step;		// 0 for a scalar left argument, 1 for an array
+} FUSESTEP;
+
+// A chain being evaluated, shared by the threads
+typedef struct {
+	FUSESTEP	*steps;
+	int			nsteps;
+	double		*psrc;		// Right argument of the first step
+	int			sstep;		// 0 if it is a scalar, 1 if an array
+	double		*pout;		// Result, unless it is packed
+	aplbits		*pbits;		// Packed boolean result
+	double		*pfold;		// Reduction of each block, or of all
+	int			assoc;		// Reduction by an associative function
+} FUSEJOB;
+
+// Number of code bytes of a left argument that can be fused, 0 if
+// it can't: a number or a variable
+static int FuseAtomLength(char *pc)
+{
+	switch (*pc) {
+	case APL_NUM:
+	case APL_INT:
+	case APL_VARINX:
+		return 2;
+	case APL_VARNAM:
+		return 2 + pc[1];
+	}
+
+	return 0;
+}
+
+// Find the left argument of a fused step. Returns 0 if it is
+// not a number or a double array of the given shape.
+static int FuseArg(ENV *penv, FUSESTEP *ps, int *prank, aplshape **ppshape)
+{
+	char *pc = ps->pcode + 1;
+	DESC *pd;
+	VNAME *pn;
+
+	ps->step = 0;
+	ps->parg = &ps->arg;
+	switch (*pc) {
+	case APL_NUM:
+		ps->arg = penv->plitBase[(unsigned char)pc[1]];
+		return 1;
+	case APL_INT:
+		ps->arg = (double)*(aplint *)(penv->plitBase + (unsigned char)pc[1]);
+		return 1;
+	case APL_VARINX:
+		pd = penv->pvarBase + pc[1];
+		break;
+	default:	// APL_VARNAM
+		pn = GetName(pc[1], pc + 2);
+		if (!pn || !pn->odesc)
+			return 0;
+		pd = (DESC *)WKSPTR(pn->odesc);
+		if (!IS_VARIABLE(pd))
+			return 0;
+		break;
+	}
+
+	if (ISSCALAR(pd)) {
+		if (TYPE(pd) == TNUM)
+			ps->arg = VNUM(pd);
+		else if (TYPE(pd) == TINT)
+			ps->arg = (double)VINT(pd);
+		else
+			return 0;
+		return 1;
+	}
+
+	if (TYPE(pd) != TNUM)
+		return 0;
+
+	// The first array argument sets the shape of the chain
+	if (*prank < 0) {
+		*prank = RANK(pd);
+		*ppshape = SHAPE(pd);
+	} else if (RANK(pd) != *prank ||
+		memcmp(SHAPE(pd), *ppshape, *prank * sizeof(aplshape)))
+		return 0;
+
+	ps->step = 1;
+	ps->parg = VPTR(pd);
+	return 1;
+}
+
+// Evaluate elements start..end-1 of a chain
+static void FuseTask(void *parg, int start, int end)
+{
+	FUSEJOB *pj = parg;
+	FUSESTEP *ps;
+	double block[FUSE_BLOCK + 1];
+	double *px, *pdst, acc = 0;
+	aplbits word;
+	int n;
+
+	// Blocks are done from the last to the first, so that a reduction
+	// adds them up in the same order as Reduce()
+	for (int i = start + (end - start - 1) / FUSE_BLOCK * FUSE_BLOCK; i >= start; i -= FUSE_BLOCK) {
+		px = pj->sstep ? pj->psrc + i : pj->psrc;
+		n = min(end - i, FUSE_BLOCK);
+		for (int k = 0; k < pj->nsteps; ++k) {
+			ps = pj->steps + k;
+			if (ps->fold && pj->assoc) {
+				// Combined later like the blocks of FoldVector()
+				pj->pfold[i / FUSE_BLOCK] = ps->fold(block, n);
+				break;
+			} else if (ps->fold) {
+				// The value of the blocks on the right is the last element
+				if (i + n < end)
+					block[n++] = acc;
+				acc = ps->fold(block, n);
+				break;
+			}
+			pdst = k == pj->nsteps - 1 && pj->pout ? pj->pout + i : block;
+			if (ps->monadic)
+				ps->monadic(pdst, px, n);
+			else
+				ps->dyadic(pdst, ps->step ? ps->parg + i : ps->parg, px, n);
+			px = pdst;
+		}
+		if (pj->pbits) {
+			for (int j = 0; j < n; j += 64) {
+				word = 0;
+				for (int b = 0; b < min(n - j, 64); ++b)
+					word |= (aplbits)(block[j + b] != 0) << b;
+				pj->pbits[(i + j) / 64] = word;
+			}
+		}
+	}
+
+	if (pj->pfold && !pj->assoc)
+		pj->pfold[0] = acc;
+}
+
+// Evaluate a chain of scalar functions starting at the current position.
+// Returns 0 if there is no chain worth fusing there.
+static int FuseChain(ENV *penv)
+{
+	FUSESTEP steps[FUSE_MAXSTEPS], *ps;
+	FUSEJOB job;
+	double seed;
+	aplshape *pshape;
+	char *pc;
+	int nsteps, nelem, rank, sstep, fun, nxt, len, last, grain;
+
+	// Start from a double array or from a number
+	if (TYPE(poprTop) == TNUM && ISARRAY(poprTop)) {
+		if (NumElem(poprTop) < FUSE_MINELEM)
+			return 0;
+		rank = RANK(poprTop);
+		pshape = SHAPE(poprTop);
+		sstep = 1;
+	} else if (ISSCALAR(poprTop) && (TYPE(poprTop) == TNUM || TYPE(poprTop) == TINT)) {
+		// Then the first left argument must be an array. This is
+		// checked first, as scalar loops come this way all the time.
+		rank = -1;
+		sstep = 0;
+		steps[0].pcode = penv->pCode;
+		if (!IsDyadic((unsigned char)penv->pCode[0]) || !FuseAtomLength(penv->pCode + 1) ||
+			!FuseArg(penv, steps, &rank, &pshape) || rank < 0)
+			return 0;
+		rank = -1;
+	} else
+		return 0;
+
+	// Find the functions of the chain by the code alone
+	pc = penv->pCode;
+	for (nsteps = 0; nsteps < FUSE_MAXSTEPS; ) {
+		ps = steps + nsteps;
+		ps->pcode = pc;
+		ps->dyadic = NULL;
+		ps->monadic = NULL;
+		ps->fold = NULL;
+		fun = pc[0];
+		nxt = pc[1];
+		last = 0;
+		if ((fun == APL_SLASH || fun == APL_SLASH_BAR) && IsDyadic(nxt)) {
+			if (nxt >= sizeof(NumFolds) / sizeof(NumFolds[0]) || !NumFolds[nxt])
+				break;
+			ps->fold = NumFolds[nxt];
+			ps->pnext = pc + 2;
+			last = 1;
+		} else if (IsDyadic(fun) && IsAtom(nxt)) {
+			if (fun >= NUM_FUNS || !NumKernels[fun][0] || !(len = FuseAtomLength(pc + 1)))
+				break;
+			ps->dyadic = NumKernels[fun][0];
+			ps->pnext = pc + 1 + len;
+			last = IsBoolFun(fun);
+		} else if (IsMonadic(fun) && nxt != APL_DOT && (ps->monadic = MonadicKernel(fun)) != NULL)
+			ps->pnext = pc + 1;
+		else
+			break;
+		pc = ps->pnext;
+		++nsteps;
+		if (last)
+			break;
+	}
+	if (nsteps < 2)
+		return 0;
+
+	// Find the arguments, which may cut the chain short
+	for (int k = 0; k < nsteps; ++k) {
+		ps = steps + k;
+		fun = *ps->pcode;
+		if (ps->dyadic) {
+			if (!FuseArg(penv, ps, &rank, &pshape)) {
+				nsteps = k;
+				break;
+			}
+			// Without an array on either side there is nothing to fuse
+			if (rank < 0)
+				return 0;
+			ps->dyadic = NumKernels[fun][KERN_CLASS(ps->step, k || sstep)];
+		} else if (rank < 0 || (ps->fold && rank != 1)) {
+			nsteps = k;
+			break;
+		}
+	}
+	if (nsteps < 2)
+		return 0;
+
+	nelem = 1;
+	for (int i = 0; i < rank; ++i)
+		nelem *= pshape[i];
+	if (nelem < FUSE_MINELEM)
+		return 0;
+
+	// The argument on top of the stack is replaced by the result
+	job.steps = steps;
+	job.nsteps = nsteps;
+	job.sstep = sstep;
+	if (sstep)
+		job.psrc = VPTR(poprTop);
+	else {
+		seed = TYPE(poprTop) == TNUM ? VNUM(poprTop) : (double)VINT(poprTop);
+		job.psrc = &seed;
+	}
+	job.pout = NULL;
+	job.pbits = NULL;
+	job.pfold = NULL;
+	grain = POOL_GRAIN;
+	ps = steps + nsteps - 1;
+	job.assoc = 0;
+	if (ps->fold) {
+		// Only associative functions may reduce blocks separately
+		job.assoc = IsAssocFun(ps->pcode[1]);
+		if (!job.assoc)
+			grain = nelem;
+		job.pfold = TempAlloc(sizeof(double), (nelem + FUSE_BLOCK - 1) / FUSE_BLOCK);
+		RANK(poprTop) = 0;
+	} else {
+		RANK(poprTop) = rank;
+		memmove(SHAPE(poprTop), pshape, rank * sizeof(aplshape));
+		if (ps->dyadic && IsBoolFun(*ps->pcode)) {
+			job.pbits = BoolAlloc(poprTop, nelem);
+			TYPE(poprTop) = TBOOL;
+		} else {
+			job.pout = DoubleAlloc(poprTop, nelem);
+			TYPE(poprTop) = TNUM;
+		}
+	}
+
+	PoolFor(FuseTask, &job, nelem, grain);
+
+	if (ps->fold) {
+		TYPE(poprTop) = TNUM;
+		*DoubleAlloc(poprTop, 1) = job.assoc ?
+			FoldPartials(ps->fold, job.pfold, (nelem + FUSE_BLOCK - 1) / FUSE_BLOCK) :
+			job.pfold[0];
+	}
+
+	penv->pCode = steps[nsteps - 1].pnext;
+	return 1;
+}
+
 static void EvlMonadicFun(ENV *penv, int fun, int axis, int axis_type)
 {
+	MATHKERNEL kernel;
 	double *pold, *pnew;
 	double num;
 	char *pchr;
@@ -1236,11 +2692,26 @@ static void EvlMonadicFun(ENV *penv, int fun, int axis, int axis_type)
 	if (axis_type == AXIS_REGULAR && !(fun == APL_CIRCLE_STILE || fun == APL_CIRCLE_BAR))
 		EvlError(EE_SYNTAX_ERROR);
 
+	// Only transpose, reverse and shape accept a view
+	if (fun != APL_TRANSPOSE && fun != APL_CIRCLE_STILE && fun != APL_CIRCLE_BAR && fun != APL_RHO)
+		ViewExpand(poprTop);
+
+	if (TYPE(poprTop) == TAP && ApMonadicFun(fun, axis_type))
+		return;
+	IntWiden(poprTop);
+
+	// Packed booleans are kept only by + , and ~
+	if (fun != APL_PLUS && fun != APL_COMMA && fun != APL_TILDE)
+		BoolToInt(poprTop);
+
 	// Handle non-scalar functions first
 	switch (fun) {
 	case APL_IOTA:			// ⍳N
 		FunIota();
 		return;
+	case APL_CUP:			// ∪V
+		FunUnique();
+		return;
 	case APL_RHO:			// ⍴A
 		FunShape();
 		return;
@@ -1271,46 +2742,50 @@ static void EvlMonadicFun(ENV *penv, int fun, int axis, int axis_type)
 	if (TYPE(poprTop) == TCHR && fun != APL_COMMA)
 		EvlError(EE_DOMAIN);
 
-	typ = TYPE(poprTop);
+	typ = TYPE(poprTop);
+
+	// Packed booleans: + and , don't change the elements
+	// and ~ inverts all bits
+	if (typ == TBOOL) {
+		if (fun == APL_TILDE) {
+			aplbits *pold = VPTR(poprTop);
+			nElem = NumElem(poprTop);
+			tmp = BOOL_WORDS(nElem);
+			aplbits *pnew = IsDeadTemp(pold, tmp * sizeof(aplbits), poprTop + 1) ?
+				pold : TempAlloc(sizeof(aplbits), tmp);
+			for (int i = 0; i < tmp; ++i)
+				pnew[i] = ~pold[i];
+			if (nElem & 63)
+				pnew[tmp - 1] &= ((aplbits)1 << (nElem & 63)) - 1;
+			VOFF(poprTop) = WKSOFF(pnew);
+			return;
+		}
+		if (fun == APL_PLUS || fun == APL_COMMA) {
+			if (fun == APL_COMMA) {
+				nElem = NumElem(poprTop);
+				RANK(poprTop) = 1;
+				SHAPE(poprTop)[0] = nElem;
+			}
+			return;
+		}
+	}
+
+	if (typ == TINT) {
+		if (EvlMonadicIntFun(fun))
+			return;
+		ToDouble(poprTop);
+		typ = TNUM;
+	}
 
 	if (ISSCALAR(poprTop)) {
 		if (typ == TNUM) {
+			if ((kernel = MonadicKernel(fun)) != NULL) {
+				kernel(&VNUM(poprTop), &VNUM(poprTop), 1);
+				return;
+			}
 			switch (fun) {
-			case APL_CIRCLE:
-				VNUM(poprTop) *= M_PI;
-				break;
-			case APL_MINUS:
-				VNUM(poprTop) = - VNUM(poprTop);
-				break;
-			case APL_STAR:
-				VNUM(poprTop) = exp(VNUM(poprTop));
-				break;
 			case APL_QUESTION_MARK:
-				tmp = (int)VNUM(poprTop);
-				if (tmp) VNUM(poprTop) = (rand() % tmp) + g_origin;
-				else VNUM(poprTop) = (double)rand() / (double)RAND_MAX;
-				break;
-			case APL_STILE:
-				VNUM(poprTop) = fabs(VNUM(poprTop));
-				break;
-			case APL_CIRCLE_STAR:
-				if (!(num = VNUM(poprTop)))
-					EvlError(EE_DOMAIN);
-				VNUM(poprTop) = log(VNUM(poprTop));
-				break;
-			case APL_UP_STILE:
-				VNUM(poprTop) = ceil(VNUM(poprTop));
-				break;
-			case APL_DOWN_STILE:
-				VNUM(poprTop) = floor(VNUM(poprTop));
-				break;
-			case APL_TIMES:	/* Sign */
-				VNUM(poprTop) = SIGN(VNUM(poprTop));
-				break;
-			case APL_DIV:	/* Inverse */
-				if (!(num = VNUM(poprTop)))
-					EvlError(EE_DIVIDE_BY_ZERO);
-				VNUM(poprTop) = 1.0 / num;
+				RandRoll(&g_rand, &VNUM(poprTop), &VNUM(poprTop), 1);
 				break;
 			case APL_TILDE:	/* Not */
 				if (!(num = VNUM(poprTop)))
@@ -1351,74 +2826,28 @@ static void EvlMonadicFun(ENV *penv, int fun, int axis, int axis_type)
 		nElem = NumElem(poprTop);
 		// + doesn't change the array
 		// , just changes the descriptor
-		// All other functions need to allocate a new array
+		// All other functions need a new array, unless the
+		// argument dies here
 		if (fun != APL_PLUS && fun != APL_COMMA) {
 			pold  = VPTR(poprTop);
-			pnew  = TempAlloc(sizeof(double), nElem);
-			VOFF(poprTop) = WKSOFF(pnew);
+			if (IsDeadTemp(pold, nElem * sizeof(double), poprTop + 1))
+				pnew = pold;
+			else {
+				pnew = TempAlloc(sizeof(double), nElem);
+				VOFF(poprTop) = WKSOFF(pnew);
+			}
+		}
+		if ((kernel = MonadicKernel(fun)) != NULL) {
+			ParMathKernel(kernel, pnew, pold, nElem);
+			return;
 		}
 		switch (fun) {
-		case APL_CIRCLE:
-			while (nElem--)
-				*pnew++ = *pold++ * M_PI;
-			break;
 		case APL_COMMA:
 			RANK(poprTop) = 1;
 			SHAPE(poprTop)[0] = nElem;
 			break;
-		case APL_MINUS:
-			while (nElem--)
-				*pnew++ = -*pold++;
-			break;
-		case APL_STAR:
-			while (nElem--)
-				*pnew++ = exp(*pold++);
-			break;
 		case APL_QUESTION_MARK:
-			while (nElem--) {
-				tmp = (int)*pold++;
-				if (tmp) *pnew++ = (rand() % tmp) + g_origin;
-				else *pnew++ = (double)rand() / (double)RAND_MAX;
-			}
-			break;
-		case APL_STILE:
-			while (nElem--) {
-				num = *pold++;
-				*pnew++ = fabs(num);
-			}
-			break;
-		case APL_CIRCLE_STAR:
-			while (nElem--) {
-				if (!(num = *pold++))
-					EvlError(EE_DOMAIN);
-				*pnew++ = log(num);
-			}
-			break;
-		case APL_UP_STILE:
-			while (nElem--) {
-				num = *pold++;
-				*pnew++ = ceil(num);
-			}
-			break;
-		case APL_DOWN_STILE:
-			while (nElem--) {
-				num = *pold++;
-				*pnew++ = floor(num);
-			}
-			break;
-		case APL_TIMES:	/* Sign */
-			while (nElem--) {
-				num = *pold++;
-				*pnew++ = SIGN(num);
-			}
-			break;
-		case APL_DIV:	/* Inverse */
-			while (nElem--) {
-				num = *pold++;
-				if (!num)
-					EvlError(EE_DIVIDE_BY_ZERO);
-				*pnew++ = 1.0 / num;
-			}
+			ParRoll(pnew, pold, nElem);
 			break;
 		case APL_TILDE:	/* Not */
 			while (nElem--) {
@@ -1444,6 +2873,74 @@ static void EvlMonadicFun(ENV *penv, int fun, int axis, int axis_type)
 	}
 }
 
+// Monadic functions on integers
+// Returns 0 if the argument must be converted to doubles
+static int EvlMonadicIntFun(int fun)
+{
+	aplint *pold, *pnew;
+	aplint num;
+	int nElem;
+
+	switch (fun) {
+	case APL_PLUS:
+	case APL_UP_STILE:
+	case APL_DOWN_STILE:
+		// Nothing to do
+		return 1;
+	case APL_COMMA:
+	case APL_MINUS:
+	case APL_STILE:
+	case APL_TIMES:
+	case APL_TILDE:
+		break;
+	default:
+		return 0;
+	}
+
+	nElem = NumElem(poprTop);
+	pold = VPTR(poprTop);
+
+	// Check before changing anything
+	for (int i = 0; i < nElem; ++i) {
+		num = pold[i];
+		if (fun == APL_TILDE && num != 0 && num != 1)
+			EvlError(EE_DOMAIN);
+		if ((fun == APL_MINUS || fun == APL_STILE) && num == INT64_MIN)
+			return 0;
+	}
+
+	if (fun == APL_COMMA) {
+		if (ISSCALAR(poprTop)) {
+			pnew = TempAlloc(sizeof(aplint), 1);
+			*pnew = VINT(poprTop);
+			VOFF(poprTop) = WKSOFF(pnew);
+		}
+		RANK(poprTop) = 1;
+		SHAPE(poprTop)[0] = nElem;
+		return 1;
+	}
+
+	// Internal storage and dead temporaries can be updated in place
+	if (ISINTSTO(poprTop) || IsDeadTemp(pold, nElem * sizeof(aplint), poprTop + 1))
+		pnew = pold;
+	else {
+		pnew = TempAlloc(sizeof(aplint), nElem);
+		VOFF(poprTop) = WKSOFF(pnew);
+	}
+
+	while (nElem--) {
+		num = *pold++;
+		switch (fun) {
+		case APL_MINUS:	*pnew++ = -num;			break;
+		case APL_STILE:	*pnew++ = num < 0 ? -num : num;	break;
+		case APL_TIMES:	*pnew++ = SIGN(num);	break;
+		case APL_TILDE:	*pnew++ = !num;			break;
+		}
+	}
+
+	return 1;
+}
+
 static double Binomial(double x, double y)
 {
 	// X!Y ←→ (!Y)÷(!X)×!Y-X
@@ -1469,29 +2966,24 @@ static void EvlNumInnerProd(int funL, int funR, ARRAYINFO *L, ARRAYINFO *R)
 	int nelem = ni * nj;				// # of elements of result
 	int R_stride = R->stride[0];
 
+	int n = R->shape[0];
+	NUMKERNEL kernR = NumKernel(funR, KERN_SA);
+	NUMKERNEL kernL = NumKernel(funL, KERN_AA);
+
 	TYPE(poprTop) = TNUM;
 	double *pdst = DoubleAlloc(poprTop, nelem);
+	double *ptmp = TempAlloc(sizeof(double), nj);
 
+	// Each row of the result is computed at once, from the last
+	// row of R to the first:
+	//   Z[i;] ← L[i;k] funR R[k;] funL Z[i;]
 	for (int i = 0; i < ni; ++i) {
-		for (int j = 0; j < nj; ++j) {
-			double *pL = psrL + R->shape[0];
-			double *pR = psrR + j + R_stride * R->shape[0];
-			// Apply funR accross last elements of L and R
-			pL -= 1;
-			pR -= R_stride;
-			double dotprod = EvlDyadicScalarNumFun(funR, *pL, *pR);
-			// Continue with remaining elements (starting from 1)
-			for (int k = 1; k < R->shape[0]; ++k) {
-				double temp;
-				// Apply funR across vectors
-				pL -= 1;
-				pR -= R_stride;
-				temp = EvlDyadicScalarNumFun(funR, *pL, *pR);
-				// Apply funL to accumulate
-				dotprod = EvlDyadicScalarNumFun(funL, temp, dotprod);
-			}
-			*pdst++ = dotprod;
+		kernR(pdst, psrL + n - 1, psrR + (n - 1) * R_stride, nj);
+		for (int k = n - 2; k >= 0; --k) {
+			kernR(ptmp, psrL + k, psrR + k * R_stride, nj);
+			kernL(pdst, ptmp, pdst, nj);
 		}
+		pdst += nj;
 		psrL += L->shape[axis];
 	}
 }
@@ -1560,6 +3052,9 @@ static void EvlInnerProd(int funL, int funR)
 
 	// A funL . funR B
 
+	ToDouble(poprTop);
+	ToDouble(poprTop + 1);
+
 	// Left argument
 	ArrayInfo(&L);
 
@@ -1622,43 +3117,64 @@ static void EvlInnerProd(int funL, int funR)
 	}
 }
 
+// Rows start..end-1 of an outer product, each as long as the right argument
+static void OuterRowsTask(void *parg, int start, int end)
+{
+	KERNTASK *pt = parg;
+
+	for (int i = start; i < end; ++i)
+		pt->kernel(pt->pz + i * pt->n, pt->px + i, pt->py, pt->n);
+}
+
 static void EvlNumOuterProd(int fun, ARRAYINFO *L, ARRAYINFO *R)
 {
-	double *pdst = TempAlloc(sizeof(double), L->nelem * R->nelem);
-	VOFF(poprTop) = WKSOFF(pdst);
+	if (IsBoolFun(fun)) {
+		EvlBoolOuterProd(fun, L, R);
+		return;
+	}
+
+	KERNTASK task = { .kernel = NumKernel(fun, KERN_SA), .px = L->vptr,
+		.py = R->vptr, .n = R->nelem };
+
+	task.pz = DoubleAlloc(poprTop, L->nelem * R->nelem);
+
+	// One row of the result for each element of L
+	PoolFor(OuterRowsTask, &task, L->nelem, POOL_GRAIN / max(R->nelem, 1));
+}
+
+// Result is a packed boolean array (an integer if scalar)
+static void EvlBoolOuterProd(int fun, ARRAYINFO *L, ARRAYINFO *R)
+{
+	aplbits *pdst = BoolAlloc(poprTop, L->nelem * R->nelem);
+	TYPE(poprTop) = ISSCALAR(poprTop) ? TINT : TBOOL;
 
 	double *pL = (double *)L->vptr;
-	double *pR;
-	for (int i = 0; i < L->nelem; ++i) {
+	for (int i = 0, k = 0; i < L->nelem; ++i) {
 		double *pR = (double *)R->vptr;
 		double numL = *pL++;
-		for (int j = 0; j < R->nelem; ++j) {
-			*pdst++ = EvlDyadicScalarNumFun(fun, numL, *pR++);
+		for (int j = 0; j < R->nelem; ++j, ++k) {
+			if (EvlDyadicScalarNumFun(fun, numL, *pR++))
+				pdst[k >> 6] |= (aplbits)1 << (k & 63);
 		}
 	}
 }
 
 static void EvlStrOuterProd(int fun, ARRAYINFO *L, ARRAYINFO *R)
 {
-	// Result will be a boolean array
-	double *pdst = TempAlloc(sizeof(double), L->nelem * R->nelem);
-	VOFF(poprTop) = WKSOFF(pdst);
+	if (fun != APL_EQUAL && fun != APL_NOT_EQUAL)
+		EvlError(EE_DOMAIN);
+
+	// Result is a packed boolean array (an integer if scalar)
+	aplbits *pdst = BoolAlloc(poprTop, L->nelem * R->nelem);
+	TYPE(poprTop) = ISSCALAR(poprTop) ? TINT : TBOOL;
 
 	char *pL = (char *)L->vptr;
-	char *pR;
-	for (int i = 0; i < L->nelem; ++i) {
+	for (int i = 0, k = 0; i < L->nelem; ++i) {
 		char *pR = (char *)R->vptr;
 		char argL = *pL++;
-		for (int j = 0; j < R->nelem; ++j) {
-			char argR = *pR++;
-			switch (fun) {
-			case APL_EQUAL:
-				*pdst++ = argL == argR;
-				break;
-			case APL_NOT_EQUAL:
-				*pdst++ = argL != argR;
-				break;
-			}
+		for (int j = 0; j < R->nelem; ++j, ++k) {
+			if ((*pR++ == argL) ^ (fun == APL_NOT_EQUAL))
+				pdst[k >> 6] |= (aplbits)1 << (k & 63);
 		}
 	}
 }
@@ -1670,6 +3186,9 @@ static void EvlOuterProd(int fun)
 
 	// A ∘. fun B
 
+	ToDouble(poprTop);
+	ToDouble(poprTop + 1);
+
 	// Left argument
 	ArrayInfo(&L);
 
@@ -1701,18 +3220,18 @@ static void EvlOuterProd(int fun)
 
 static void FunShape(void)
 {
-	double *pnew;
+	aplint *pnew;
 	aplshape shape[MAXDIM];
 	int rank;
 
 	rank = RANK(poprTop);
 	COPY_SHAPE(shape, SHAPE(poprTop), rank);
 
-	TYPE(poprTop) = TNUM;
+	TYPE(poprTop) = TINT;
 	RANK(poprTop) = 1;
 	SHAPE(poprTop)[0] = rank;
 
-	pnew = DoubleAlloc(poprTop, rank);
+	pnew = IntAlloc(poprTop, rank);
 
 	for (int i = 0; i < rank; ++i)
 		*pnew++ = shape[i];
@@ -1720,6 +3239,8 @@ static void FunShape(void)
 
 static void FunSystem1(int fun)
 {
+	ViewExpand(poprTop);
+
 	switch (fun) {
 	case SYS_IDENT:
 		SysIdent();
@@ -1746,8 +3267,9 @@ static void FunReshape(void)
 	// V ⍴ A
 
 	// Left argument must be numeric
-	if (TYPE(poprTop) != TNUM)
+	if (!ISNUMBER(poprTop))
 		EvlError(EE_DOMAIN);
+	ToDouble(poprTop);
 
 	if (RANK(poprTop) > 1)
 		EvlError(EE_RANK);
@@ -1770,9 +3292,9 @@ static void FunReshape(void)
 	COPY_SHAPE(SHAPE(poprTop), shape, rank);
 	RANK(poprTop) = rank;
 
-	if (TYPE(poprTop) == TNUM) {
+	if (ISNUMBER(poprTop)) {
 		if (nelem > A.nelem || (rank > A.rank && ISINTSTO(poprTop))) {
-			double proto = 0.0;
+			double proto = 0.0;	// Same bits as integer 0
 			double *pold = A.nelem ? A.vptr : &proto;
 			double *pnew = DoubleAlloc(poprTop, nelem);
 			pdbl = pold;
@@ -1803,6 +3325,7 @@ static void FunReshape(void)
 
 static void FunReverse(int axis)
 {
+	VIEW *pv;			// View of the argument
 	aplshape	shape[MAXDIM];	// Shape of the argument
 	int size[MAXDIM];	// Sizes of axes of the argument
 	int outer[MAXDIM];	// Number of super-arrays for each axis
@@ -1816,7 +3339,17 @@ static void FunReverse(int axis)
 	if (!ISARRAY(poprTop))
 		return;
 
-	is_num = TYPE(poprTop) == TNUM;
+	// Reversing a view or an array in external storage only changes the strides
+	if ((pv = ViewOf(poprTop)) != NULL) {
+		int n = SHAPE(poprTop)[axis];
+		int size = pv->type == TCHR ? sizeof(char) : sizeof(double);
+		if (n)
+			pv->doff += (ptrdiff_t)(n - 1) * pv->stride[axis] * size;
+		pv->stride[axis] = -pv->stride[axis];
+		return;
+	}
+
+	is_num = ISNUMBER(poprTop);
 	rank = RANK(poprTop);
 
 	// Fill in shape[] and size[]
@@ -2022,6 +3555,7 @@ static void FunRotate(int axis)
 	// A must be numeric
 	if (!ISNUMBER(poprTop))
 		EvlError(EE_DOMAIN);
+	ToDouble(poprTop);
 
 	POP(poprTop);
 
@@ -2097,6 +3631,12 @@ static void FunCatenate(int axis, int axis_type)
 
 	// A,[axis]B
 
+	// Integers and doubles result in doubles
+	if (TYPE(poprTop) != TYPE(poprTop + 1) && ISNUMBER(poprTop) && ISNUMBER(poprTop + 1)) {
+		ToDouble(poprTop);
+		ToDouble(poprTop + 1);
+	}
+
 	// Left argument
 	ArrayInfo(&L);
 
@@ -2156,7 +3696,7 @@ static void FunCatenate(int axis, int axis_type)
 	}
 	SHAPE(poprTop)[axis] = L.shape[axis] + R.shape[axis];
 
-	if (L.type == TNUM) {	// Numbers
+	if (L.type != TCHR) {	// Numbers
 		double *psrL = (double *)L.vptr;
 		double *psrR = (double *)R.vptr;
 		double *pdst = DoubleAlloc(poprTop, L.nelem + R.nelem);
@@ -2272,6 +3812,7 @@ static void FunCatenate(int axis, int axis_type)
 static void FunCompress(int axis)
 {
 	int	*mask;			// Copy of the left argument
+	aplbits *bits;		// Packed left argument
 	int	shape[MAXDIM];	// Shape of the right argument
 	int size[MAXDIM];	// Sizes of axes of the right argument
 	int outer[MAXDIM];	// Number of super-arrays for each axis
@@ -2293,7 +3834,19 @@ static void FunCompress(int axis)
 	if (!ISNUMBER(poprTop))
 		EvlError(EE_DOMAIN);
 
-	if (ISARRAY(poprTop)) {
+	bits = NULL;
+	if (TYPE(poprTop) == TBOOL) {
+		lhs_is_scalar = 0;
+		if (RANK(poprTop) != 1)
+			EvlError(EE_RANK);
+
+		// The mask isn't unpacked unless needed
+		masklen = NumElem(poprTop);
+		bits = TempAlloc(sizeof(aplbits), BOOL_WORDS(masklen));
+		memcpy(bits, VPTR(poprTop), BOOL_WORDS(masklen) * sizeof(aplbits));
+		shape_axis = BoolCount(bits, 0, masklen);
+		mask = NULL;
+	} else if (ISARRAY(poprTop)) {
 		lhs_is_scalar = 0;
 		if (RANK(poprTop) != 1)
 			EvlError(EE_RANK);
@@ -2322,8 +3875,9 @@ static void FunCompress(int axis)
 		if (lhs_is_scalar) {
 			int m = mask[0];
 			masklen = SHAPE(poprTop)[axis];
-			shape_axis = m * masklen;
-			for (int i = 1; i < masklen; ++i)
+			shape_axis = abs(m) * masklen;
+			mask = TempAlloc(sizeof(int), masklen);
+			for (int i = 0; i < masklen; ++i)
 				mask[i] = m;
 		}
 
@@ -2372,6 +3926,43 @@ static void FunCompress(int axis)
 		incr = 0;	// Don't increment psrc (use the same scalar value)
 	}
 
+	if (bits && incr && axis == rank - 1 && nelem_dst) {
+		// Packed mask along the last axis: skip the 0's a word at a time
+		int nwords = BOOL_WORDS(masklen);
+
+		SHAPE(poprTop)[axis] = shape_axis;
+		if (rhs_is_num) {
+			double *pdst = TempAlloc(sizeof(double), nelem_dst);
+			double *psrc = (double *)parr;
+			VOFF(poprTop) = WKSOFF(pdst);
+			for (int i = 0; i < outer[axis]; ++i) {
+				for (int w = 0; w < nwords; ++w) {
+					for (aplbits word = bits[w]; word; word &= word - 1)
+						*pdst++ = psrc[(w << 6) + __builtin_ctzll(word)];
+				}
+				psrc += masklen;
+			}
+		} else {
+			char *pdst = TempAlloc(sizeof(char), nelem_dst);
+			char *psrc = parr;
+			VOFF(poprTop) = WKSOFF(pdst);
+			for (int i = 0; i < outer[axis]; ++i) {
+				for (int w = 0; w < nwords; ++w) {
+					for (aplbits word = bits[w]; word; word &= word - 1)
+						*pdst++ = psrc[(w << 6) + __builtin_ctzll(word)];
+				}
+				psrc += masklen;
+			}
+		}
+		return;
+	}
+
+	if (bits) {
+		// Other cases use the unpacked mask
+		mask = TempAlloc(sizeof(int), masklen);
+		for (int i = 0; i < masklen; ++i)
+			mask[i] = BOOL_GET(bits, i);
+	}
 
 	// Set result
 	VOFF(poprTop) = 0;
@@ -2483,7 +4074,22 @@ static void FunExpand(int axis)
 	if (!ISNUMBER(poprTop))
 		EvlError(EE_DOMAIN);
 
-	if (ISARRAY(poprTop)) {
+	if (TYPE(poprTop) == TBOOL) {
+		lhs_is_scalar = 0;
+		if (RANK(poprTop) != 1)
+			EvlError(EE_RANK);
+
+		// 1 → take next element, 0 → insert 1 zero (or ' ')
+		masklen = NumElem(poprTop);
+		mask = TempAlloc(sizeof(int), masklen);
+		aplbits *pbits = VPTR(poprTop);
+
+		shape_axis = masklen;
+		num_pos = BoolCount(pbits, 0, masklen);
+		for (int i = 0; i < masklen; ++i)
+			mask[i] = BOOL_GET(pbits, i) ? 1 : -1;
+	} else if (ISARRAY(poprTop)) {
+		ToDouble(poprTop);
 		lhs_is_scalar = 0;
 		if (RANK(poprTop) != 1)
 			EvlError(EE_RANK);
@@ -2507,6 +4113,7 @@ static void FunExpand(int axis)
 			++pdbl;
 		}
 	} else {
+		ToDouble(poprTop);
 		lhs_is_scalar = 1;	// rhs must also be a scalar
 		masklen = 1;
 		mask = TempAlloc(sizeof(int), masklen);
@@ -2666,6 +4273,23 @@ static void FunExpand(int axis)
 	}	
 }
 
+// Deal shuffles all the numbers when it draws at least 1/DEAL_DENSE
+// of them. Otherwise it keeps the numbers drawn in a hash set whose
+// slots hold a number plus one, 0 meaning empty.
+#define	DEAL_DENSE	8
+
+// Slot of num in the set, or the empty slot where it goes
+static size_t DealFind(aplint *pset, int bits, aplint num)
+{
+	size_t mask = ((size_t)1 << bits) - 1;
+	size_t slot = (size_t)(((uint64_t)num * 0x9E3779B97F4A7C15ULL) >> (64 - bits));
+
+	while (pset[slot] && pset[slot] != num + 1)
+		slot = (slot + 1) & mask;
+
+	return slot;
+}
+
 static void	FunDeal(void)
 {
 	ARRAYINFO L;
@@ -2682,25 +4306,28 @@ static void	FunDeal(void)
 	if (L.nelem != 1 || R.nelem != 1)
 		EvlError(EE_LENGTH);
 
-	if (L.type != TNUM || R.type != TNUM)
+	if (!ISNUMBER(&L) || !ISNUMBER(&R))
 		EvlError(EE_DOMAIN);
+	InfoToDouble(&L);
+	InfoToDouble(&R);
 
-	// Arguments must be integers
+	// Arguments must be non-negative integers
 	num = *(double *)L.vptr;
-	int nelem = (int)num;
-	if ((double)nelem != num)
+	if (num < 0 || num != floor(num))
 		EvlError(EE_DOMAIN);
 
-	if (nelem > MAXIND)	// We don't support a vector this big
+	if (num > MAXIND)	// We don't support a vector this big
 		EvlError(EE_LENGTH);
-	
+	int nelem = (int)num;
+
+	// R has the same limit as in ?R
 	num = *(double *)R.vptr;
-	int total = (int)num;
-	if ((double)total != num)
+	if (num < 0 || num != floor(num) || num > 9007199254740992.0)
 		EvlError(EE_DOMAIN);
+	aplint total = (aplint)num;
 
-	// Arguments must be non-negative and L<=R
-	if (nelem < 0 || total < 0 || nelem > total)
+	// L<=R
+	if (nelem > total)
 		EvlError(EE_DOMAIN);
 
 	// Set result
@@ -2710,41 +4337,58 @@ static void	FunDeal(void)
 	if (!nelem)	// Zero elements
 		return;
 
-	// Allocate a bitmap to mark available slots
-	int nbytes = ALIGN_UP(total,8) / 8;
-	uint8_t *bits = (uint8_t *)TempAlloc(sizeof(uint8_t), nbytes);
-	// 1 = available, 0 = already drawn
-	memset(bits, 0xff, nbytes);
-	// Fix last byte mask
-	int rest = total & 7;
-	int mask = 0;
-	for (int i = 0; i < rest; ++i)
-		mask = (mask << 1) | 1;
-	if (mask)
-		bits[nbytes-1] = mask;
-
 	// Allocate result vector
-	double *pdst = TempAlloc(sizeof(double), nelem);
+	aplint *pdst = TempAlloc(sizeof(aplint), nelem);
+	TYPE(poprTop) = TINT;
 	VOFF(poprTop) = WKSOFF(pdst);
 
-	// Draw 'nelem' numbers from 'total'
-	for (int i = 0; i < nelem; ++i) {
-		int tmp = (rand() % total);
-		// Check if available
-		int ind = tmp / 8;
-		int bit = 1 << (tmp % 8);
+	if (total / DEAL_DENSE <= nelem) {
+		// Partial Fisher-Yates shuffle of 0..total-1
+		if (total > INT32_MAX)
+			EvlError(EE_ARRAY_OVERFLOW);
+		int *pperm = TempAlloc(sizeof(int), (int)total);
+		for (int i = 0; i < total; ++i)
+			pperm[i] = i;
+		for (int i = 0; i < nelem; ++i) {
+			int j = i + (int)RandBelow(&g_rand, (uint64_t)(total - i));
+			int tmp = pperm[j];
+			pperm[j] = pperm[i];
+			pdst[i] = tmp + g_origin;
+		}
+		return;
+	}
 
-		while (!(bits[ind] & bit)) { // This loop is guaranteed to end
-			// Try next ones, wrap-around if necessary
-			if (tmp < total - 1) ++tmp;
-			else tmp = 0;
-			ind = tmp / 8;
-			bit = 1 << (tmp % 8);
+	// Floyd's algorithm
+	int bits = 1;
+	while (((aplint)1 << bits) < 2 * (aplint)nelem)
+		++bits;
+	if (bits > 30)
+		EvlError(EE_ARRAY_OVERFLOW);
+	aplint *pset = TempAlloc(sizeof(aplint), 1 << bits);
+	memset(pset, 0, ((size_t)1 << bits) * sizeof(aplint));
+
+	int k = 0;
+	for (aplint j = total - nelem; j < total; ++j, ++k) {
+		aplint num = (aplint)RandBelow(&g_rand, (uint64_t)j + 1);
+		size_t slot = DealFind(pset, bits, num);
+		// If num was drawn before take j, which can't have been
+		if (pset[slot]) {
+			num = j;
+			slot = DealFind(pset, bits, num);
 		}
+		pset[slot] = num + 1;
+		pdst[k] = num;
+	}
 
-		bits[ind] &= ~bit;
-		*pdst++ = tmp + g_origin;
+	// Floyd's algorithm chooses the numbers, not their order
+	for (int i = nelem - 1; i > 0; --i) {
+		int j = (int)RandBelow(&g_rand, i + 1);
+		aplint tmp = pdst[i];
+		pdst[i] = pdst[j];
+		pdst[j] = tmp;
 	}
+	for (int i = 0; i < nelem; ++i)
+		pdst[i] += g_origin;
 }
 
 static void FunDecode()
@@ -2757,8 +4401,10 @@ static void FunDecode()
 	POP(poprTop);
 	ArrayInfo(&R);
 
-	if (L.type != TNUM || R.type != TNUM)
+	if (!ISNUMBER(&L) || !ISNUMBER(&R))
 		EvlError(EE_DOMAIN);
+	InfoToDouble(&L);
+	InfoToDouble(&R);
 
 	if (L.rank != 1 || R.rank != 1)
 		EvlError(EE_RANK);
@@ -2793,6 +4439,7 @@ static void FunMatDivide(void)
 	// Left argument must be a numeric vector
 	if (!ISNUMBER(poprTop))
 		EvlError(EE_DOMAIN);
+	ToDouble(poprTop);
 	if (!ISARRAY(poprTop) || RANK(poprTop) != 1)
 		EvlError(EE_RANK);
 
@@ -2804,6 +4451,7 @@ static void FunMatDivide(void)
 	// Right argument must be a numeric matrix
 	if (!ISNUMBER(poprTop))
 		EvlError(EE_DOMAIN);
+	ToDouble(poprTop);
 	if (!ISARRAY(poprTop) || RANK(poprTop) != 2)
 		EvlError(EE_RANK);
 
@@ -2856,6 +4504,7 @@ static void FunMatInverse(void)
 	// Argument must be a numeric square matrix
 	if (!ISNUMBER(poprTop))
 		EvlError(EE_DOMAIN);
+	ToDouble(poprTop);
 	if (!ISARRAY(poprTop) || RANK(poprTop) != 2)
 		EvlError(EE_RANK);
 
@@ -2912,8 +4561,10 @@ static void FunEncode()
 	if (RANK(poprTop) == 0)
 		R.rank = 0;
 
-	if (L.type != TNUM || R.type != TNUM)
+	if (!ISNUMBER(&L) || !ISNUMBER(&R))
 		EvlError(EE_DOMAIN);
+	InfoToDouble(&L);
+	InfoToDouble(&R);
 
 	if (L.rank != 1)
 		EvlError(EE_RANK);
@@ -2927,6 +4578,7 @@ static void FunEncode()
 
 	// Prepare result
 	// Shape of result = (⍴L),⍴R
+	TYPE(poprTop) = TNUM;
 	RANK(poprTop) = R.rank + 1;
 	for (int i = R.rank; i > 0; --i)
 		SHAPE(poprTop)[i] = R.shape[i - 1];
@@ -3006,6 +4658,7 @@ static void FunDrop()
 	// Only numbers
 	if (!ISNUMBER(poprTop))
 		EvlError(EE_DOMAIN);
+	ToDouble(poprTop);
 
 	if (ISARRAY(poprTop)) {			// Array (2 3↓y)
 		double *pdbl;
@@ -3027,6 +4680,11 @@ static void FunDrop()
 	}
 
 	POP(poprTop);
+
+	// Dropping from a view or an array in external storage builds a view
+	if (ViewTakeDrop(dst_drops, dst_rank, 1))
+		return;
+	ViewExpand(poprTop);
 	
 	// Right argument (source)
 	rhs_is_num = ISNUMBER(poprTop);
@@ -3117,6 +4775,7 @@ static void FunTake()
 	// Only numbers
 	if (!ISNUMBER(poprTop))
 		EvlError(EE_DOMAIN);
+	ToDouble(poprTop);
 
 	if (ISARRAY(poprTop)) {			// Array (2 3↑y)
 		double *pdbl;
@@ -3141,6 +4800,12 @@ static void FunTake()
 	}
 
 	POP(poprTop);
+
+	// Taking from a view or an array in external storage without
+	// padding builds a view
+	if (ViewTakeDrop(dst_shape, dst_rank, 0))
+		return;
+	ViewExpand(poprTop);
 	
 	// Right argument (source)
 	rhs_is_num = ISNUMBER(poprTop);
@@ -3266,6 +4931,7 @@ get_index:
 
 static void FunDyadicTranspose(void)
 {
+	VIEW *pv;				// View of A
 	int dst_shape[MAXDIM];	// Shape of result
 	int src_size[MAXDIM];	// Size of source A
 	int index[MAXDIM];		// Argument index
@@ -3343,6 +5009,23 @@ static void FunDyadicTranspose(void)
 	if (src_rank == 1)
 		return;
 
+	// Transposing a view or an array in external storage only changes
+	// the shape and strides. Axes that go to the same result axis
+	// (diagonal) add their strides.
+	if ((pv = ViewOf(poprTop)) != NULL) {
+		int stride[MAXDIM];
+		for (int i = 0; i < dst_rank; ++i)
+			stride[i] = 0;
+		for (int j = 0; j < src_rank; ++j)
+			stride[perm[j]] += pv->stride[j];
+		RANK(poprTop) = dst_rank;
+		for (int i = 0; i < dst_rank; ++i) {
+			SHAPE(poprTop)[i] = dst_shape[i];
+			pv->stride[i] = stride[i];
+		}
+		return;
+	}
+
 	if (is_num) {		// Numbers
 		double *pdst;
 		double *psrc;
@@ -3378,6 +5061,7 @@ static void FunDyadicTranspose(void)
 
 static void FunTranspose(void)
 {
+	VIEW *pv;				// View of argument
 	int shape[MAXDIM];		// Shape of argument
 	int index[MAXDIM];		// Argument index
 	int tr_size[MAXDIM];	// Size of transpose in reverse order
@@ -3390,6 +5074,20 @@ static void FunTranspose(void)
 	if ((rank = RANK(poprTop)) < 2)
 		return;
 
+	// Transposing a view or an array in external storage only reverses
+	// the shape and strides
+	if ((pv = ViewOf(poprTop)) != NULL) {
+		for (int i = 0, j = rank - 1; i < j; ++i, --j) {
+			int n = SHAPE(poprTop)[i];
+			SHAPE(poprTop)[i] = SHAPE(poprTop)[j];
+			SHAPE(poprTop)[j] = n;
+			n = pv->stride[i];
+			pv->stride[i] = pv->stride[j];
+			pv->stride[j] = n;
+		}
+		return;
+	}
+
 	is_num = ISNUMBER(poprTop);
 
 	nelem = 1;
@@ -3586,6 +5284,7 @@ static void FormatOut()
 	ArrayInfo(&A);
 	if (!A.nelem)
 		return;
+	InfoToDouble(&A);
 
 	if (ISSCALAR(&A))
 		nc = nr = 1;
@@ -3642,6 +5341,7 @@ static void FunFormat(void)
 
 	ARRAYINFO A;
 	ArrayInfo(&A);
+	InfoToDouble(&A);
 	int nc = A.shape[A.rank-1];	// # of cols = # shape of last dimension
 	int nr = A.nelem / nc;		// total # of rows
 
@@ -3683,6 +5383,9 @@ static void FunFormat2(void)
 	if (R.type == TCHR)
 		return;
 
+	InfoToDouble(&L);
+	InfoToDouble(&R);
+
 	int nc = R.shape[R.rank-1];	// # of cols = # shape of last dimension
 	int nr = R.nelem / nc;		// total # of rows
 
@@ -3733,101 +5436,467 @@ static void FunFormat2(void)
 			pf->width = w;
 			pf->prec = p;
 		}
-	} else
-		EvlError(EE_LENGTH);
+	} else
+		EvlError(EE_LENGTH);
+
+	// Calculate row length in characters
+	int rowlen = 0;
+	for (int i = 0; i < nc; ++i)
+		rowlen += 1 + (pfmt + i)->width;	// Include column separator
+
+	// Set result
+	int buflen = rowlen * nr;
+	char *pdst = TempAlloc(sizeof(char), buflen);
+	TYPE(poprTop) = TCHR;
+	RANK(poprTop) = R.rank;
+	SHAPE(poprTop)[R.rank - 1] = rowlen;
+	VOFF(poprTop) = WKSOFF(pdst);
+	double *psrc = (double *)R.vptr;
+	for (int i = 0; i < nr; ++i) {
+		FormatRow(pdst, psrc, nc, pfmt);
+		psrc += nc;
+		pdst += rowlen;
+	}
+}
+
+// Grades are found by sorting the indices of the elements on keys that
+// compare like the elements as unsigned integers. Integers get their sign
+// bit flipped; doubles get it flipped if positive or all their bits
+// flipped if negative, with -0 made 0. Grade down complements the keys.
+// The sort is stable, so equal elements keep ascending indices for
+// both ⍋ and ⍒.
+//
+// Arrays of higher rank are graded on their rows (the cells along the
+// first axis) in lexicographic order. Character rows are sorted on keys
+// made of 8 characters at a time, from the last 8 to the first, each
+// sort keeping the order of the previous one for equal keys. Numeric
+// rows are compared element by element in a merge sort.
+#define	RADIX_BITS	11		// Bits per digit
+#define	RADIX_SIZE	(1 << RADIX_BITS)
+#define	RADIX_PASSES	((64 + RADIX_BITS - 1) / RADIX_BITS)
+#define	RADIX_MIN	64		// Shorter vectors are sorted by insertion
+#define	SORT_RUN	(POOL_GRAIN / 2)	// Shortest run of a parallel sort
+#define	SORT_RUNS	16			// and most runs if they are longer
+#define	SORT_PAR_MIN	POOL_GRAIN	// Shorter vectors are sorted serially
+#define	ROW_RUN		16		// Rows sorted by insertion before merging
+
+typedef struct {
+	void		*pelem;		// Elements being graded
+	int			type;		// TINT, TNUM or TCHR
+	uint64_t	flip;		// All 1's for grade down
+	int			cell;		// Elements per row (1 for vectors)
+	int			col;		// First column of a key of character rows
+} GRADE;
+
+// Key of element i of a numeric array
+static inline uint64_t ElemKey(GRADE *pg, int i)
+{
+	uint64_t key;
+	double num;
+
+	if (pg->type == TINT)
+		key = (uint64_t)((aplint *)pg->pelem)[i] ^ ((uint64_t)1 << 63);
+	else {
+		num = ((double *)pg->pelem)[i];
+		if (num == 0.0)
+			num = 0.0;
+		memcpy(&key, &num, sizeof(key));
+		key = key >> 63 ? ~key : key | ((uint64_t)1 << 63);
+	}
+
+	return key ^ pg->flip;
+}
+
+// Key of row i: the element itself for numeric vectors or up to 8
+// characters of a character row, from column pg->col
+static inline uint64_t GradeKey(GRADE *pg, int i)
+{
+	unsigned char *prow;
+	uint64_t key = 0;
+	int len;
+
+	if (pg->type != TCHR)
+		return ElemKey(pg, i);
+
+	prow = (unsigned char *)pg->pelem + i * pg->cell + pg->col;
+	len = min(8, pg->cell - pg->col);
+	for (int k = 0; k < 8; ++k)
+		key = key << 8 | (k < len ? prow[k] : 0);
+
+	return key ^ pg->flip;
+}
+
+// Numeric rows are compared element by element
+static inline int IsRowGrade(GRADE *pg)
+{
+	return pg->type != TCHR && pg->cell > 1;
+}
+
+// Compare rows a and b
+static int GradeCmp(GRADE *pg, int a, int b)
+{
+	uint64_t ka, kb;
+
+	if (!IsRowGrade(pg)) {
+		ka = GradeKey(pg, a);
+		kb = GradeKey(pg, b);
+		return ka < kb ? -1 : ka > kb;
+	}
+
+	for (int k = 0; k < pg->cell; ++k) {
+		ka = ElemKey(pg, a * pg->cell + k);
+		kb = ElemKey(pg, b * pg->cell + k);
+		if (ka != kb)
+			return ka < kb ? -1 : 1;
+	}
+
+	return 0;
+}
+
+// Stable insertion sort of the n indices pidx
+static void InsertionSort(GRADE *pg, int *pidx, int n)
+{
+	for (int i = 1; i < n; ++i) {
+		int idx = pidx[i];
+		int j;
+		for (j = i; j > 0 && GradeCmp(pg, pidx[j - 1], idx) > 0; --j)
+			pidx[j] = pidx[j - 1];
+		pidx[j] = idx;
+	}
+}
+
+// Stable LSD radix sort of the n indices pidx on their keys. ptmp is
+// scratch space of the same size. The keys are found again in every
+// pass, so no space is needed for them. Digits that are the same in all
+// keys are skipped. The sorted indices are left in pidx.
+static void RadixSort(GRADE *pg, int *pidx, int *ptmp, int n)
+{
+	int count[RADIX_PASSES][RADIX_SIZE];
+	int *pdone = pidx;
+
+	memset(count, 0, sizeof(count));
+	for (int i = 0; i < n; ++i) {
+		uint64_t key = GradeKey(pg, pidx[i]);
+		for (int d = 0; d < RADIX_PASSES; ++d, key >>= RADIX_BITS)
+			++count[d][key & (RADIX_SIZE - 1)];
+	}
+
+	for (int d = 0; d < RADIX_PASSES; ++d) {
+		int shift = d * RADIX_BITS;
+		int *pcnt = count[d];
+
+		// All keys in the same bucket?
+		if (pcnt[(GradeKey(pg, pidx[0]) >> shift) & (RADIX_SIZE - 1)] == n)
+			continue;
+
+		// Turn counts into starting positions
+		for (int b = 0, pos = 0; b < RADIX_SIZE; ++b) {
+			int cnt = pcnt[b];
+			pcnt[b] = pos;
+			pos += cnt;
+		}
 
-	// Calculate row length in characters
-	int rowlen = 0;
-	for (int i = 0; i < nc; ++i)
-		rowlen += 1 + (pfmt + i)->width;	// Include column separator
+		for (int i = 0; i < n; ++i) {
+			int idx = pidx[i];
+			ptmp[pcnt[(GradeKey(pg, idx) >> shift) & (RADIX_SIZE - 1)]++] = idx;
+		}
 
-	// Set result
-	int buflen = rowlen * nr;
-	char *pdst = TempAlloc(sizeof(char), buflen);
-	TYPE(poprTop) = TCHR;
-	RANK(poprTop) = R.rank;
-	SHAPE(poprTop)[R.rank - 1] = rowlen;
-	VOFF(poprTop) = WKSOFF(pdst);
-	double *psrc = (double *)R.vptr;
-	for (int i = 0; i < nr; ++i) {
-		FormatRow(pdst, psrc, nc, pfmt);
-		psrc += nc;
-		pdst += rowlen;
+		int *pt = pidx; pidx = ptmp; ptmp = pt;
 	}
+
+	if (pidx != pdone)
+		memcpy(pdone, pidx, n * sizeof(int));
 }
 
-static int qsort_double_up(void *base, const void *p1, const void *p2)
+// Merge sorts sort runs of a given width in parallel (by insertion when
+// rows are compared, otherwise by radix sort) and then merge them
+// pairwise until one run is left. Every output chunk of a merge finds
+// where it starts in the two runs by a binary search, so all threads
+// help with each round, including the last one.
+typedef struct {
+	GRADE		*pg;
+	int			*psrc;		// Runs to be sorted or merged
+	int			*pdst;		// Merged runs or scratch space
+	int			n;
+	int			width;		// Length of the runs
+} SORTJOB;
+
+static void SortRunTask(void *parg, int start, int end)
 {
-	int i1 = (int)*(double *)p1 - g_origin;
-	int i2 = (int)*(double *)p2 - g_origin;
-	double elem1 = *((double *)base + i1);
-	double elem2 = *((double *)base + i2);
+	SORTJOB *pj = parg;
 
-	if (elem1 < elem2) return -1;
-	else if (elem1 > elem2) return 1;
-	return 0;
+	for (int lo = start; lo < end; lo += pj->width) {
+		int len = min(pj->width, end - lo);
+		if (len < RADIX_MIN || IsRowGrade(pj->pg))
+			InsertionSort(pj->pg, pj->psrc + lo, len);
+		else
+			RadixSort(pj->pg, pj->psrc + lo, pj->pdst + lo, len);
+	}
 }
 
-static int qsort_double_down(void *base, const void *p1, const void *p2)
+static void SortMergeTask(void *parg, int start, int end)
 {
-	int i1 = (int)*(double *)p1 - g_origin;
-	int i2 = (int)*(double *)p2 - g_origin;
-	double elem1 = *((double *)base + i1);
-	double elem2 = *((double *)base + i2);
+	SORTJOB *pj = parg;
+	GRADE *pg = pj->pg;
+
+	while (start < end) {
+		int lo = start / (2 * pj->width) * (2 * pj->width);
+		int *pa = pj->psrc + lo;
+		int na = min(pj->width, pj->n - lo);
+		int *pb = pa + na;
+		int nb = min(pj->width, pj->n - lo - na);
+		int k = start - lo;
+		int i, j, ilo, ihi;
+		int *pz = pj->pdst + start;
+		int *pend = pj->pdst + min(end, lo + na + nb);
+
+		// Find how many of the first k outputs come from a, taking
+		// elements of a first when the rows are equal
+		ilo = max(0, k - nb);
+		ihi = min(k, na);
+		while (ilo < ihi) {
+			i = (ilo + ihi) / 2;
+			if (GradeCmp(pg, pa[i], pb[k - i - 1]) <= 0)
+				ilo = i + 1;
+			else
+				ihi = i;
+		}
+		i = ilo;
+		j = k - i;
 
-	if (elem1 < elem2) return 1;
-	else if (elem1 > elem2) return -1;
-	return 0;
+		for (; pz < pend; ++pz) {
+			if (j >= nb || (i < na && GradeCmp(pg, pa[i], pb[j]) <= 0))
+				*pz = pa[i++];
+			else
+				*pz = pb[j++];
+		}
+		start = pend - pj->pdst;
+	}
 }
 
-static int qsort_char_up(void *base, const void *p1, const void *p2)
+// Stable merge sort of the n indices pidx starting with runs of width
+// elements. ptmp is scratch space of the same size. The sorted indices
+// are left in pidx.
+static void MergeSort(GRADE *pg, int *pidx, int *ptmp, int n, int width)
 {
-	int i1 = (int)*(double *)p1 - g_origin;
-	int i2 = (int)*(double *)p2 - g_origin;
-	char elem1 = *((char *)base + i1);
-	char elem2 = *((char *)base + i2);
+	SORTJOB job = { pg, pidx, ptmp, n, width };
 
-	if (elem1 < elem2) return -1;
-	else if (elem1 > elem2) return 1;
-	return 0;
+	PoolFor(SortRunTask, &job, n, max(width, POOL_GRAIN));
+
+	for (; job.width < n; job.width *= 2) {
+		PoolFor(SortMergeTask, &job, n, POOL_GRAIN);
+		int *pt = job.psrc; job.psrc = job.pdst; job.pdst = pt;
+	}
+
+	if (job.psrc != pidx)
+		memcpy(pidx, job.psrc, n * sizeof(int));
 }
 
-static int qsort_char_down(void *base, const void *p1, const void *p2)
+// Stable sort of the n indices pidx on their keys
+// Large vectors are sorted in parallel
+static void KeySort(GRADE *pg, int *pidx, int *ptmp, int n)
 {
-	int i1 = (int)*(double *)p1 - g_origin;
-	int i2 = (int)*(double *)p2 - g_origin;
-	char elem1 = *((char *)base + i1);
-	char elem2 = *((char *)base + i2);
+	int width = SORT_RUN;
 
-	if (elem1 < elem2) return 1;
-	else if (elem1 > elem2) return -1;
-	return 0;
+	if (n < RADIX_MIN)
+		InsertionSort(pg, pidx, n);
+	else if (n < SORT_PAR_MIN || g_num_threads == 1)
+		RadixSort(pg, pidx, ptmp, n);
+	else {
+		while (width < (n + SORT_RUNS - 1) / SORT_RUNS)
+			width *= 2;
+		MergeSort(pg, pidx, ptmp, n, width);
+	}
 }
 
 static void FunGradeUpDown(int fun)
 {
 	ARRAYINFO V;
+	int n;
 
-	if (!ISARRAY(poprTop) || RANK(poprTop) != 1)
+	if (!ISARRAY(poprTop))
 		EvlError(EE_RANK);
 
 	ArrayInfo(&V);
+	n = V.shape[0];
+
+	// Result is an integer vector (indices)
+	// Until the end its two halves hold the indices as int's
+	// and scratch space for the sorts
+	aplint *base = TempAlloc(sizeof(aplint), n);
+	int *pidx = (int *)base;
+	TYPE(poprTop) = TINT;
+	RANK(poprTop) = 1;
+	SHAPE(poprTop)[0] = n;
+	VOFF(poprTop) = WKSOFF(base);
+
+	for (int i = 0; i < n; ++i)
+		pidx[i] = i;
+
+	GRADE G = { V.vptr, V.type, fun == APL_GRADE_UP ? 0 : ~(uint64_t)0,
+		n ? V.nelem / n : 0, 0 };
+
+	if (n < 2 || G.cell == 0)
+		;	// Already in order
+	else if (V.rank == 1 && V.type == TCHR) {
+		// Counting sort
+		unsigned char *psrc = (unsigned char *)V.vptr;
+		unsigned char flip = fun == APL_GRADE_UP ? 0 : 255;
+		int count[256] = { 0 };
+		int *ptmp = pidx + n;
+
+		for (int i = 0; i < n; ++i)
+			++count[psrc[i] ^ flip];
+		for (int c = 0, pos = 0; c < 256; ++c) {
+			int cnt = count[c];
+			count[c] = pos;
+			pos += cnt;
+		}
+		for (int i = 0; i < n; ++i)
+			ptmp[count[psrc[i] ^ flip]++] = i;
+		memcpy(pidx, ptmp, n * sizeof(int));
+	} else if (V.type == TCHR) {
+		// Sort on the last key of the rows first
+		for (G.col = (G.cell - 1) / 8 * 8; G.col >= 0; G.col -= 8)
+			KeySort(&G, pidx, pidx + n, n);
+	} else if (IsRowGrade(&G))
+		MergeSort(&G, pidx, pidx + n, n, ROW_RUN);
+	else
+		KeySort(&G, pidx, pidx + n, n);
 
-	// Result is a numeric vector (indices)
-	double *base = TempAlloc(sizeof(double), V.nelem);
-	double *pdst = base;
-	TYPE(poprTop) = TNUM;
-	VOFF(poprTop) = WKSOFF(pdst);
+	// Widen the indices from the end so that none is overwritten
+	// before it is read
+	for (int i = n - 1; i >= 0; --i)
+		base[i] = (aplint)pidx[i] + g_origin;
+}
+
+// Search arrays of integers or doubles through a hash table of their
+// elements (open addressing, linear probing). Each slot holds the index
+// plus one of an element, 0 meaning empty. The keys are the bit
+// patterns of the elements, with -0 made 0 so that both find each other.
+#define	HASH_MIN	16		// Smaller searches are done linearly
+
+typedef struct {
+	int			*slots;
+	int			mask;		// # of slots - 1
+	int			shift;		// 64 - log2(# of slots)
+	int			type;		// TINT or TNUM
+	void		*pelem;		// Elements in the table
+} HASHTAB;
+
+static inline uint64_t HashKey(int type, void *pelem, int i)
+{
+	uint64_t key;
+	double num;
 
-	// Populate vector with sequential indices
-	for (int i = 0, j = g_origin; i < V.nelem; ++i, ++j)
-		*pdst++ = (double)j;
+	if (type == TINT)
+		return ((aplint *)pelem)[i];
 
-	// Sort it
-	if (V.type == TNUM)
-		qsort_r(base, V.nelem, sizeof(double), V.vptr, fun == APL_GRADE_UP ? qsort_double_up : qsort_double_down);
-	else
-		qsort_r(base, V.nelem, sizeof(double), V.vptr, fun == APL_GRADE_UP ? qsort_char_up : qsort_char_down);
+	num = ((double *)pelem)[i];
+	if (num == 0.0)
+		num = 0.0;
+	memcpy(&key, &num, sizeof(key));
+	return key;
+}
+
+static inline int HashSlot(HASHTAB *ph, uint64_t key)
+{
+	return (int)((key * 0x9E3779B97F4A7C15ULL) >> ph->shift);
+}
+
+// Build the table of the nelem elements at pelem
+// Only the first of equal elements is kept
+static void HashBuild(HASHTAB *ph, int type, void *pelem, int nelem)
+{
+	int bits = 1;
+
+	// At least twice as many slots as elements
+	while ((1 << bits) < 2 * nelem)
+		++bits;
+
+	ph->type = type;
+	ph->pelem = pelem;
+	ph->mask = (1 << bits) - 1;
+	ph->shift = 64 - bits;
+	ph->slots = TempAlloc(sizeof(int), ph->mask + 1);
+	memset(ph->slots, 0, (ph->mask + 1) * sizeof(int));
+
+	for (int i = 0; i < nelem; ++i) {
+		uint64_t key = HashKey(type, pelem, i);
+		int slot = HashSlot(ph, key);
+		int *ps;
+
+		for (ps = ph->slots + slot; *ps; ps = ph->slots + slot) {
+			if (HashKey(type, pelem, *ps - 1) == key)
+				break;
+			slot = (slot + 1) & ph->mask;
+		}
+		if (!*ps)
+			*ps = i + 1;
+	}
+}
+
+// Index in the table's array of the element i of pkeys
+// Returns -1 if it's not there
+static int HashFind(HASHTAB *ph, void *pkeys, int i)
+{
+	uint64_t key = HashKey(ph->type, pkeys, i);
+	int slot = HashSlot(ph, key);
+	int index;
+
+	while ((index = ph->slots[slot])) {
+		if (HashKey(ph->type, ph->pelem, index - 1) == key)
+			return index - 1;
+		slot = (slot + 1) & ph->mask;
+	}
+
+	return -1;
+}
+
+// Set the bits of pin for the elements of L that are in R
+static void MemberMask(ARRAYINFO *pL, ARRAYINFO *pR, aplbits *pin)
+{
+	if (pL->type == TCHR) {
+		// Mask of the characters in R
+		aplbits inR[4] = { 0 };
+		unsigned char *psrL = (unsigned char *)pL->vptr;
+		unsigned char *psrR = (unsigned char *)pR->vptr;
+		for (int j = 0; j < pR->nelem; ++j)
+			inR[psrR[j] >> 6] |= (aplbits)1 << (psrR[j] & 63);
+		for (int i = 0; i < pL->nelem; ++i)
+			pin[i >> 6] |= (aplbits)BOOL_GET(inR, psrL[i]) << (i & 63);
+	} else if (pL->nelem > HASH_MIN && pR->nelem > HASH_MIN) {
+		HASHTAB H;
+		HashBuild(&H, pR->type, pR->vptr, pR->nelem);
+		for (int i = 0; i < pL->nelem; ++i)
+			pin[i >> 6] |= (aplbits)(HashFind(&H, pL->vptr, i) >= 0) << (i & 63);
+	} else if (pL->type == TINT) {
+		aplint *psrL = (aplint *)pL->vptr;
+		aplint *psrR = (aplint *)pR->vptr;
+		for (int i = 0; i < pL->nelem; ++i) {
+			aplint num = *(psrL + i);
+			aplint res = 0;
+			for (int j = 0; j < pR->nelem; ++j)
+				if (*(psrR + j) == num) {
+					res = 1;
+					break;
+				}
+			pin[i >> 6] |= (aplbits)res << (i & 63);
+		}
+	} else {
+		double *psrL = (double *)pL->vptr;
+		double *psrR = (double *)pR->vptr;
+		for (int i = 0; i < pL->nelem; ++i) {
+			double num = *(psrL + i);
+			aplint res = 0;
+			for (int j = 0; j < pR->nelem; ++j)
+				if (*(psrR + j) == num) {
+					res = 1;
+					break;
+				}
+			pin[i >> 6] |= (aplbits)res << (i & 63);
+		}
+	}
 }
 
 static void FunMembership()
@@ -3841,133 +5910,471 @@ static void FunMembership()
 	POP(poprTop);
 	ArrayInfo(&R);
 
+	// Integers and doubles are compared as doubles
+	if (L.type != R.type && ISNUMBER(&L) && ISNUMBER(&R)) {
+		InfoToDouble(&L);
+		InfoToDouble(&R);
+	}
+
 	if (L.type != R.type)
 		EvlError(EE_DOMAIN);
 
 	// Result is a boolean array with the same shape as L
-	double *pdst = TempAlloc(sizeof(double), L.nelem);
-	TYPE(poprTop) = TNUM;
-	VOFF(poprTop) = WKSOFF(pdst);
+	// A packed scalar is the same as the integer 0 or 1
+	TYPE(poprTop) = ISSCALAR(&L) ? TINT : TBOOL;
 	// Copy rank/shape of left argument to result
 	RANK(poprTop) = L.rank;
 	for (int i = 0; i < L.rank; ++i)
 		SHAPE(poprTop)[i] = L.shape[i];
+	aplbits *pdst = BoolAlloc(poprTop, L.nelem);
 	
-	if (L.type == TNUM) {
-		double *psrL = (double *)L.vptr;
-		double *psrR = (double *)R.vptr;
-		for (int i = 0; i < L.nelem; ++i) {
-			double num = *(psrL + i);
-			double res = 0;
-			for (int j = 0; j < R.nelem; ++j)
-				if (*(psrR + j) == num) {
-					res = 1;
-					break;
-				}
-			*pdst++ = res;
+	MemberMask(&L, &R, pdst);
+}
+
+// Make the result a vector of the elements of A whose bits in
+// pdrop are 0
+static void KeepElements(ARRAYINFO *pA, aplbits *pdrop)
+{
+	int count = pA->nelem - BoolCount(pdrop, 0, pA->nelem);
+
+	TYPE(poprTop) = pA->type;
+	RANK(poprTop) = 1;
+	SHAPE(poprTop)[0] = count;
+
+	if (pA->type == TCHR) {
+		char *psrc = (char *)pA->vptr;
+		char *pdst = CharAlloc(poprTop, count);
+		for (int i = 0; i < pA->nelem; ++i)
+			if (!BOOL_GET(pdrop, i))
+				*pdst++ = psrc[i];
+	} else {
+		// Integers and doubles have the same size
+		aplint *psrc = (aplint *)pA->vptr;
+		aplint *pdst = IntAlloc(poprTop, count);
+		for (int i = 0; i < pA->nelem; ++i)
+			if (!BOOL_GET(pdrop, i))
+				*pdst++ = psrc[i];
+	}
+}
+
+// ∪V: the elements of V without repetitions, in the order in
+// which they first appear
+static void FunUnique(void)
+{
+	ARRAYINFO V;
+	aplbits *pdup;
+
+	if (RANK(poprTop) > 1)
+		EvlError(EE_RANK);
+
+	ArrayInfo(&V);
+
+	// Mark the elements seen before
+	pdup = TempAlloc(sizeof(aplbits), BOOL_WORDS(V.nelem));
+	memset(pdup, 0, BOOL_WORDS(V.nelem) * sizeof(aplbits));
+
+	if (V.type == TCHR) {
+		// Mask of the characters seen
+		aplbits seen[4] = { 0 };
+		unsigned char *psrc = (unsigned char *)V.vptr;
+		for (int i = 0; i < V.nelem; ++i) {
+			int chr = psrc[i];
+			pdup[i >> 6] |= (aplbits)BOOL_GET(seen, chr) << (i & 63);
+			seen[chr >> 6] |= (aplbits)1 << (chr & 63);
 		}
+	} else if (V.nelem > HASH_MIN) {
+		// The table keeps the first of equal elements
+		HASHTAB H;
+		HashBuild(&H, V.type, V.vptr, V.nelem);
+		for (int i = 0; i < V.nelem; ++i)
+			pdup[i >> 6] |= (aplbits)(HashFind(&H, V.vptr, i) != i) << (i & 63);
 	} else {
-		char *psrL = (char *)L.vptr;
-		char *psrR = (char *)R.vptr;
-		for (int i = 0; i < L.nelem; ++i) {
-			char chr = *(psrL + i);
-			double res = 0;
-			for (int j = 0; j < R.nelem; ++j)
-				if (*(psrR + j) == chr) {
-					res = 1;
+		for (int i = 1; i < V.nelem; ++i) {
+			for (int j = 0; j < i; ++j) {
+				if (V.type == TINT ? ((aplint *)V.vptr)[j] == ((aplint *)V.vptr)[i] :
+					((double *)V.vptr)[j] == ((double *)V.vptr)[i]) {
+					pdup[i >> 6] |= (aplbits)1 << (i & 63);
 					break;
 				}
-			*pdst++ = res;
+			}
 		}
 	}
+
+	KeepElements(&V, pdup);
+}
+
+// L~R: the elements of L that are not in R
+static void FunWithout(void)
+{
+	ARRAYINFO L;
+	ARRAYINFO R;
+	aplbits *pin;
+
+	ArrayInfo(&L);
+	POP(poprTop);
+	ArrayInfo(&R);
+
+	// Integers and doubles are compared as doubles
+	if (L.type != R.type && ISNUMBER(&L) && ISNUMBER(&R)) {
+		InfoToDouble(&L);
+		InfoToDouble(&R);
+	}
+
+	if (L.type != R.type)
+		EvlError(EE_DOMAIN);
+
+	// Left argument must be a scalar or a vector
+	if (L.rank > 1)
+		EvlError(EE_RANK);
+
+	pin = TempAlloc(sizeof(aplbits), BOOL_WORDS(L.nelem));
+	memset(pin, 0, BOOL_WORDS(L.nelem) * sizeof(aplbits));
+	MemberMask(&L, &R, pin);
+
+	KeepElements(&L, pin);
 }
 
 static void FunIota(void)
 {
-	double *pnew;
-	double num;
-	int i;
+	aplint num;
 	int nelem;
 
 	// Argument must be numeric
 	if (!ISNUMBER(poprTop))
 		EvlError(EE_DOMAIN);
 
-	if (ISSCALAR(poprTop))	// Either a scalar
-		nelem = (int)VNUM(poprTop);
-	else {					// Or a 1-element array
-		if (RANK(poprTop) != 1 || SHAPE(poprTop)[0] != 1)
-			EvlError(EE_LENGTH);
+	if (!ISSCALAR(poprTop) && (RANK(poprTop) != 1 || SHAPE(poprTop)[0] != 1))
+		EvlError(EE_LENGTH);	// Either a scalar or a 1-element array
+
+	if (TYPE(poprTop) == TINT) {
+		num = *(aplint *)VPTR(poprTop);
+		nelem = num < 0 || num > MAXIND ? -1 : (int)num;
+	} else
 		nelem = (int)*(double *)VPTR(poprTop);
-	}
 
 	if (nelem < 0 || nelem > MAXIND)
 		EvlError(EE_INVALID_INDEX);
 
-	RANK(poprTop) = 1;
-	SHAPE(poprTop)[0] = nelem;
+	// The elements are only generated when needed
+	ApSet(poprTop, nelem, g_origin, 1);
+}
 
-	if (!nelem)	// Null vector
-		return;
+// Make pd an arithmetic progression
+static void ApSet(DESC *pd, int nelem, aplint base, aplint step)
+{
+	TYPE(pd) = TAP;
+	RANK(pd) = 1;
+	SHAPE(pd)[0] = nelem;
+	VOFF(pd) = MINOFF;
+	AP_BASE(VIPTR(pd)) = base;
+	AP_STEP(VIPTR(pd)) = step;
+}
+
+// Dyadic functions whose result is another progression
+// Returns 0 if the progression must be expanded
+static int ApDyadicFun(int fun, int axis_type)
+{
+	DESC *pL = poprTop;
+	DESC *pR = poprTop + 1;
+	aplint *pap;
+	aplint base, step, num, last;
+	int nelem, count;
+
+	pap = VPTR(TYPE(pR) == TAP ? pR : pL);
+	base = AP_BASE(pap);
+	step = AP_STEP(pap);
+	nelem = SHAPE(TYPE(pR) == TAP ? pR : pL)[0];
+
+	switch (fun) {
+	case APL_PLUS:			// P+S  S+P
+	case APL_MINUS:			// P-S  S-P
+	case APL_TIMES:			// P×S  S×P
+		if (TYPE(pL) == TAP && TYPE(pR) == TINT && ISSCALAR(pR)) {
+			num = VINT(pR);
+			if (!EvlDyadicScalarIntFun(fun, base, num, &base))
+				return 0;
+		} else if (TYPE(pR) == TAP && TYPE(pL) == TINT && ISSCALAR(pL)) {
+			num = VINT(pL);
+			if (!EvlDyadicScalarIntFun(fun, num, base, &base))
+				return 0;
+			if (fun == APL_MINUS) {
+				if (step == INT64_MIN)
+					return 0;
+				step = -step;
+			}
+		} else
+			return 0;
+		if (fun == APL_TIMES && __builtin_mul_overflow(step, num, &step))
+			return 0;
+		// The other elements fit if the last one does
+		if (nelem && (__builtin_mul_overflow(step, (aplint)(nelem - 1), &last) ||
+			__builtin_add_overflow(base, last, &last)))
+			return 0;
+		POP(poprTop);
+		ApSet(poprTop, nelem, base, step);
+		return 1;
+
+	case APL_UP_ARROW:		// N↑P
+	case APL_DOWN_ARROW:	// N↓P
+		if (axis_type != AXIS_DEFAULT || TYPE(pR) != TAP || TYPE(pL) != TINT ||
+			RANK(pL) > 1 || NumElem(pL) != 1)
+			return 0;
+		num = *(aplint *)VPTR(pL);
+		if (fun == APL_UP_ARROW) {
+			if (num > nelem || num < -nelem)
+				return 0;	// Needs padding
+			count = num < 0 ? -num : num;
+			if (num < 0)	// Take from the end
+				base += (nelem - count) * step;
+		} else {
+			count = num < -nelem || num > nelem ? 0 : nelem - (num < 0 ? -num : num);
+			if (num > 0 && count)	// Drop from the beginning
+				base += num * step;
+		}
+		POP(poprTop);
+		ApSet(poprTop, count, base, step);
+		return 1;
+
+	case APL_SLASH:			// M/P
+	case APL_SLASH_BAR:		// M⌿P
+		if (axis_type != AXIS_DEFAULT || TYPE(pR) != TAP || TYPE(pL) != TBOOL ||
+			RANK(pL) != 1)
+			return 0;
+		if (SHAPE(pL)[0] != nelem)
+			EvlError(EE_LENGTH);
+		{
+			int nwords = BOOL_WORDS(nelem);
+			aplbits *bits = TempAlloc(sizeof(aplbits), nwords);
+			aplint *pnew;
+
+			memcpy(bits, VPTR(pL), nwords * sizeof(aplbits));
+			count = BoolCount(bits, 0, nelem);
+			POP(poprTop);
+			TYPE(poprTop) = TINT;
+			SHAPE(poprTop)[0] = count;
+			pnew = IntAlloc(poprTop, count);
+			for (int w = 0; w < nwords; ++w) {
+				for (aplbits word = bits[w]; word; word &= word - 1)
+					*pnew++ = base + step * ((w << 6) + __builtin_ctzll(word));
+			}
+		}
+		return 1;
+	}
+
+	return 0;
+}
+
+// Monadic functions whose result is another progression
+// Returns 0 if the progression must be expanded
+static int ApMonadicFun(int fun, int axis_type)
+{
+	aplint *pap = VPTR(poprTop);
+	aplint base = AP_BASE(pap);
+	aplint step = AP_STEP(pap);
+	int nelem = SHAPE(poprTop)[0];
+	aplint last = nelem ? base + step * (nelem - 1) : base;
+
+	switch (fun) {
+	case APL_PLUS:			// +P  ,P
+	case APL_COMMA:
+		return 1;
+	case APL_MINUS:			// -P
+		if (base == INT64_MIN || last == INT64_MIN || step == INT64_MIN)
+			return 0;
+		ApSet(poprTop, nelem, -base, -step);
+		return 1;
+	case APL_CIRCLE_STILE:	// ⌽P  ⊖P
+	case APL_CIRCLE_BAR:
+		if (axis_type != AXIS_DEFAULT || step == INT64_MIN)
+			return 0;
+		ApSet(poprTop, nelem, last, -step);
+		return 1;
+	case APL_RHO:			// ⍴P only needs the shape
+		FunShape();
+		return 1;
+	}
+
+	return 0;
+}
+
+static void	FunIndexOf(void)
+{
+	ARRAYINFO L;
+	ARRAYINFO R;
+
+	ArrayInfo(&L);
+	POP(poprTop);
+	ArrayInfo(&R);
+
+	// Integers and doubles are compared as doubles
+	if (L.type != R.type && ISNUMBER(&L) && ISNUMBER(&R)) {
+		InfoToDouble(&L);
+		InfoToDouble(&R);
+	}
+
+	// We don't have mixed arrays
+	if (L.type != R.type)
+		EvlError(EE_DOMAIN);
+
+	// Left argument must be a scalar or a vector
+	if (L.rank != 1)
+		EvlError(EE_RANK);
+
+	// Set result
+	TYPE(poprTop) = TINT;
+	RANK(poprTop) = R.rank;
+	aplint *pdst = IntAlloc(poprTop, R.nelem);
+	
+	if (R.type == TCHR) {
+		// Table of the first index of each character
+		aplint first[256];
+		unsigned char *psrL = (unsigned char *)L.vptr;
+		unsigned char *psrR = (unsigned char *)R.vptr;
+		for (int c = 0; c < 256; ++c)
+			first[c] = L.nelem + g_origin;
+		for (int j = L.nelem - 1; j >= 0; --j)
+			first[psrL[j]] = j + g_origin;
+		for (int i = 0; i < R.nelem; ++i)
+			*pdst++ = first[psrR[i]];
+	} else if (L.nelem > HASH_MIN && R.nelem > HASH_MIN) {
+		HASHTAB H;
+		HashBuild(&H, L.type, L.vptr, L.nelem);
+		for (int i = 0; i < R.nelem; ++i) {
+			int index = HashFind(&H, R.vptr, i);
+			*pdst++ = (index < 0 ? L.nelem : index) + g_origin;
+		}
+	} else if (R.type == TINT) {
+		for (int i = 0; i < R.nelem; ++i) {
+			aplint numR = *((aplint *)R.vptr + i);
+			aplint *psrL = (aplint *)L.vptr;
+			aplint index = L.nelem + g_origin;
+			for (int j = 0; j < L.nelem; ++j) {
+				if (*(psrL + j) == numR) {
+					index = j + g_origin;
+					break;
+				}
+			}
+			*pdst++ = index;
+		}
+	} else {
+		for (int i = 0; i < R.nelem; ++i) {
+			double numR = *((double *)R.vptr + i);
+			double *psrL = (double *)L.vptr;
+			aplint index = L.nelem + g_origin;
+			for (int j = 0; j < L.nelem; ++j) {
+				if (*(psrL + j) == numR) {
+					index = j + g_origin;
+					break;
+				}
+			}
+			*pdst++ = index;
+		}
+	}
+}
+
+// Are the n elements at p in ascending order?
+static int IsAscending(int type, void *p, int n)
+{
+	for (int i = 1; i < n; ++i) {
+		if (type == TINT ? ((aplint *)p)[i] < ((aplint *)p)[i - 1] :
+			type == TNUM ? ((double *)p)[i] < ((double *)p)[i - 1] :
+			((unsigned char *)p)[i] < ((unsigned char *)p)[i - 1])
+			return 0;
+	}
+
+	return 1;
+}
 
-	pnew = DoubleAlloc(poprTop, nelem);
-	num = (double)g_origin;
+// Interval index of the n elements px in the m ascending boundaries pl:
+// how many boundaries are ≤ each element, less 1 in origin 1. It is
+// found by a binary search whose loop has no branches that depend on
+// the data. When px is ascending too only the first element is searched
+// and the others are found by walking along pl.
+#define INTERVAL_INDEX(name, type) \
+static void name(type *pl, int m, type *px, aplint *pz, int n, int merge) \
+{ \
+	aplint org = g_origin - 1; \
+	int j = 0; \
+	for (int i = 0; i < n; ++i) { \
+		type y = px[i]; \
+		if (merge && i) { \
+			while (j < m && pl[j] <= y) \
+				++j; \
+		} else { \
+			type *base = pl; \
+			int len = m; \
+			for (int half; len > 1; len -= half) { \
+				half = len / 2; \
+				base = base[half] <= y ? base + half : base; \
+			} \
+			j = len ? (int)(base - pl) + (*base <= y) : 0; \
+		} \
+		pz[i] = j + org; \
+	} \
+}
+
+INTERVAL_INDEX(IntervalInt, aplint)
+INTERVAL_INDEX(IntervalNum, double)
+INTERVAL_INDEX(IntervalChr, unsigned char)
 
-	for (i = 1; i <= nelem; ++i)
-		*pnew++ = num++;
+typedef struct {
+	ARRAYINFO	*pL;		// Boundaries
+	ARRAYINFO	*pR;
+	aplint		*pz;
+	int			merge;		// R is ascending
+} INTERVALJOB;
+
+static void IntervalTask(void *parg, int start, int end)
+{
+	INTERVALJOB *pj = parg;
+	ARRAYINFO *pL = pj->pL;
+	ARRAYINFO *pR = pj->pR;
+
+	if (pL->type == TINT)
+		IntervalInt((aplint *)pL->vptr, pL->nelem, (aplint *)pR->vptr + start,
+			pj->pz + start, end - start, pj->merge);
+	else if (pL->type == TNUM)
+		IntervalNum((double *)pL->vptr, pL->nelem, (double *)pR->vptr + start,
+			pj->pz + start, end - start, pj->merge);
+	else
+		IntervalChr((unsigned char *)pL->vptr, pL->nelem, (unsigned char *)pR->vptr + start,
+			pj->pz + start, end - start, pj->merge);
 }
 
-static void	FunIndexOf(void)
+static void FunIntervalIndex(void)
 {
 	ARRAYINFO L;
 	ARRAYINFO R;
+	INTERVALJOB job = { .pL = &L, .pR = &R };
+
+	// L ⍸ R
 
 	ArrayInfo(&L);
 	POP(poprTop);
 	ArrayInfo(&R);
 
-	// We don't have mixed arrays
+	// Integers and doubles are compared as doubles
+	if (L.type != R.type && ISNUMBER(&L) && ISNUMBER(&R)) {
+		InfoToDouble(&L);
+		InfoToDouble(&R);
+	}
+
 	if (L.type != R.type)
 		EvlError(EE_DOMAIN);
 
-	// Left argument must be a scalar or a vector
-	if (L.rank != 1)
+	// Left argument must be a scalar or a vector in ascending order
+	if (L.rank > 1)
 		EvlError(EE_RANK);
+	if (!IsAscending(L.type, L.vptr, L.nelem))
+		EvlError(EE_DOMAIN);
 
-	double *pdst = TempAlloc(sizeof(double), R.nelem);
-
-	// Set result
-	TYPE(poprTop) = TNUM;
+	// Result has the same shape as R
+	TYPE(poprTop) = TINT;
 	RANK(poprTop) = R.rank;
-	VOFF(poprTop) = WKSOFF(pdst);
-	
-	if (R.type == TNUM) {
-		for (int i = 0; i < R.nelem; ++i) {
-			double numR = *((double *)R.vptr + i);
-			double *psrL = (double *)L.vptr;
-			double index = L.nelem + g_origin;
-			for (int j = 0; j < L.nelem; ++j) {
-				if (*(psrL + j) == numR) {
-					index = j + g_origin;
-					break;
-				}
-			}
-			*pdst++ = index;
-		}
-	} else {
-		for (int i = 0; i < R.nelem; ++i) {
-			char chrR = *((char *)R.vptr + i);
-			char *psrL = (char *)L.vptr;
-			double index = L.nelem + g_origin;
-			for (int j = 0; j < L.nelem; ++j) {
-				if (*(psrL + j) == chrR) {
-					index = j + g_origin;
-					break;
-				}
-			}
-			*pdst++ = index;
-		}
-	}
+	job.pz = IntAlloc(poprTop, R.nelem);
+	job.merge = R.nelem >= L.nelem && IsAscending(R.type, R.vptr, R.nelem);
+
+	PoolFor(IntervalTask, &job, R.nelem, POOL_GRAIN);
 }
 
 static double IdentElement(int fun)
@@ -4000,21 +6407,181 @@ static double IdentElement(int fun)
 	return id;
 }
 
+// Reduce a packed boolean array by counting its 1's
+// Returns 0 if the result doesn't depend only on the count
+static int ReduceBool(int fun, int axis)
+{
+	ARRAYINFO A;
+	aplbits *pbits;
+	aplint *pnew;
+	int len, stride, newsize, count;
+
+	switch (fun) {
+	case APL_PLUS:
+	case APL_AND:
+	case APL_TIMES:
+	case APL_DOWN_STILE:
+	case APL_OR:
+	case APL_UP_STILE:
+	case APL_NOT_EQUAL:
+		break;
+	default:
+		return 0;
+	}
+
+	ArrayInfo(&A);
+	if (!A.nelem)
+		return 0;	// Identity element
+
+	pbits = A.vptr;
+	len = A.shape[axis];
+	stride = A.stride[axis];
+	newsize = A.nelem / len;
+
+	// Remove one axis and reshape result
+	RANK(poprTop) = A.rank - 1;
+	memcpy(&SHAPE(poprTop)[0],    &A.shape[0],      axis * sizeof(aplshape));
+	memcpy(&SHAPE(poprTop)[axis], &A.shape[axis+1], (A.rank - 1 - axis) * sizeof(aplshape));
+	TYPE(poprTop) = TINT;
+	pnew = IntAlloc(poprTop, newsize);
+
+	for (int r = 0; r < newsize; ++r) {
+		// First element of this cell
+		int start = (r / stride) * stride * len + r % stride;
+		if (stride == 1)
+			count = BoolCount(pbits, start, len);
+		else {
+			count = 0;
+			for (int k = 0; k < len; ++k)
+				count += BOOL_GET(pbits, start + k * stride);
+		}
+		switch (fun) {
+		case APL_PLUS:			*pnew++ = count;			break;
+		case APL_AND:
+		case APL_TIMES:
+		case APL_DOWN_STILE:	*pnew++ = count == len;		break;
+		case APL_OR:
+		case APL_UP_STILE:		*pnew++ = count != 0;		break;
+		case APL_NOT_EQUAL:		*pnew++ = count & 1;		break;
+		}
+	}
+
+	return 1;
+}
+
+// Reduce an arithmetic progression without expanding it
+// Returns 0 if the function needs the elements
+static int ReduceAp(int fun)
+{
+	aplint *pap = VPTR(poprTop);
+	aplint nelem = SHAPE(poprTop)[0];
+	aplint first, last, sum, res;
+
+	if (!nelem)
+		return 0;	// Identity element
+
+	first = AP_BASE(pap);
+	last = first + AP_STEP(pap) * (nelem - 1);
+
+	switch (fun) {
+	case APL_PLUS:			// N×(first+last)÷2
+		// first+last is even if N is odd
+		if (__builtin_add_overflow(first, last, &sum) ||
+			__builtin_mul_overflow(nelem & 1 ? sum / 2 : sum, nelem & 1 ? nelem : nelem / 2, &res)) {
+			TYPE(poprTop) = TNUM;
+			RANK(poprTop) = 0;
+			VOFF(poprTop) = MINOFF;
+			VNUM(poprTop) = (double)nelem * ((double)first + (double)last) / 2;
+			return 1;
+		}
+		break;
+	case APL_UP_STILE:
+		res = max(first, last);
+		break;
+	case APL_DOWN_STILE:
+		res = min(first, last);
+		break;
+	default:
+		return 0;
+	}
+
+	TYPE(poprTop) = TINT;
+	RANK(poprTop) = 0;
+	VOFF(poprTop) = MINOFF;
+	VINT(poprTop) = res;
+
+	return 1;
+}
+
+// Integer version of the Reduce() loop
+// Returns 0 if some partial result is not an integer
+static int ReduceInt(int fun, int axis, ARRAYINFO *pA, aplint *pnew)
+{
+	aplshape shape[MAXDIM];
+	int		d, n;
+	int		rank = pA->rank - 1;
+	int		stride = pA->stride[axis];
+	int		width = pA->width;
+	aplint	num;
+	int		f, i;		// Element indices
+
+	COPY_SHAPE(shape, pA->shape, pA->rank);
+	f = 0;
+
+	do {
+		// Reduce
+		n = pA->shape[axis] - 1;
+		i = f + n * stride;
+		num = IntElem(pA->vptr, width, i);
+		while (n--) {
+			i -= stride;
+			if (!EvlDyadicScalarIntFun(fun, IntElem(pA->vptr, width, i), num, &num))
+				return 0;
+		}
+
+		// Store new element
+		*pnew++ = num;
+
+		// Iterate
+		for (d = rank; d >= 0; --d) {
+			if (d == axis)
+				continue;
+			if (--shape[d]) {
+				f += pA->size[d];
+				break;
+			}
+			shape[d] = pA->shape[d];
+			f -= (shape[d] - 1) * pA->size[d];
+		}
+	} while (d >= 0);
+
+	return 1;
+}
+
 static void Reduce(int fun, int axis)
 {
 	ARRAYINFO A;
-	aplshape	shape[MAXDIM];
-	int		d, stride, nelem, n, rank, newsize;
-	double	num, num2;
-	double	*pnew, *pf, *pd;
+	int		stride, nelem, n, rank, newsize;
+	double	*pnew, *pf;
 
 	// fun/[axis]A
 
 	if (!ISARRAY(poprTop))
 		return;
 
+	if (TYPE(poprTop) == TBOOL) {
+		if (ReduceBool(fun, axis))
+			return;
+		BoolToInt(poprTop);
+	}
+
+	if (TYPE(poprTop) == TAP) {
+		if (ReduceAp(fun))
+			return;
+		IntWiden(poprTop);
+	}
+
 	ArrayInfo(&A);
-	COPY_SHAPE(shape, SHAPE(poprTop), A.rank);
 	rank = A.rank - 1;		// New rank >= 0
 	nelem = A.nelem;
 	
@@ -4029,43 +6596,216 @@ static void Reduce(int fun, int axis)
 	if (A.shape[axis] == 1 || !nelem) {
 		if (!rank) {
 			VOFF(poprTop) = MINDIM * sizeof(aplshape);
-			VNUM(poprTop) = IdentElement(fun);
+			if (!nelem) {
+				TYPE(poprTop) = TNUM;
+				VNUM(poprTop) = IdentElement(fun);
+			} else if (ISINTEGER(A.type)) {
+				// The reduction of one element is that element
+				TYPE(poprTop) = TINT;
+				VINT(poprTop) = IntElem(A.vptr, A.width, 0);
+			} else if (A.type == TNUM)
+				VNUM(poprTop) = *(double *)A.vptr;
+			else
+				VCHR(poprTop) = *(char *)A.vptr;
 		}
 		return;
 	}
 
-	pf = A.vptr;
 	stride = A.stride[axis];
 	newsize = nelem / A.shape[axis];
 
+	// Try integer arithmetic first
+	if (ISINTEGER(A.type) && IsIntFun(fun)) {
+		aplint *pint = TempAlloc(sizeof(aplint), newsize);
+		if (ReduceInt(fun, axis, &A, pint)) {
+			TYPE(poprTop) = TINT;
+			memcpy(IntAlloc(poprTop, newsize), pint, newsize * sizeof(aplint));
+			return;
+		}
+	}
+
+	InfoToDouble(&A);
+	pf = A.vptr;
+	n = A.shape[axis];
+
 	TYPE(poprTop) = TNUM;
 	pnew = DoubleAlloc(poprTop, newsize);
 
-	do {
-		// Reduce
-		n = A.shape[axis] - 1;
-		pd = pf + n * stride;
-		num = *pd;
-		while (n--) {
-			pd -= stride;
-			num = EvlDyadicScalarNumFun(fun, *pd, num);
-		}
+	if (stride == 1) {
+		// Last axis: each result element folds a contiguous row
+		KERNTASK task = { .fold = NumFold(fun), .fun = fun, .pz = pnew,
+			.px = pf, .n = n };
+
+		if (newsize == 1 && n > POOL_GRAIN && IsAssocFun(fun)) {
+			// A long vector is folded in chunks, which are then combined
+			// as FoldVector() would, whatever the number of threads
+			task.pz = TempAlloc(sizeof(double), (n + POOL_GRAIN - 1) / POOL_GRAIN);
+			int nchunks = PoolFor(FoldChunkTask, &task, n, POOL_GRAIN);
+			pnew[0] = FoldPartials(task.fold, task.pz, nchunks);
+		} else
+			PoolFor(FoldRowsTask, &task, newsize, POOL_GRAIN / n);
+	} else {
+		// Other axes: the rows (stride elements each) of every block
+		// of n rows are combined, from the last row to the first
+		KERNTASK task = { .kernel = NumKernel(fun, KERN_AA), .fun = fun,
+			.pz = pnew, .px = pf, .n = n, .stride = stride };
 
-		// Store new element
-		*pnew++ = num;
+		PoolFor(FoldAxisTask, &task, newsize, POOL_GRAIN / n);
+	}
+}
 
-		// Iterate
-		for (d = rank; d >= 0; --d) {
-			if (d == axis)
+// Boolean scans that are settled by the first 0 or 1 (stop) of the
+// argument. Before it the result follows a fixed pattern of bits; at it
+// and after it the result is constant, but may depend on whether its
+// position is even (bit 0 of at/after) or odd (bit 1).
+typedef struct {
+	aplbits	before;		// Result before the stop
+	char	stop;		// Value that stops the scan
+	char	at;			// Result at the stop
+	char	after;		// Result after the stop
+} STOPSCAN;
+
+#define	EVEN_BITS	0x5555555555555555ULL
+#define	ODD_BITS	0xAAAAAAAAAAAAAAAAULL
+
+static const STOPSCAN StopScans[] = {
+	[APL_AND]			= { ~0ULL,		0, 0, 0 },	// 1's up to the first 0
+	[APL_TIMES]			= { ~0ULL,		0, 0, 0 },
+	[APL_DOWN_STILE]	= { ~0ULL,		0, 0, 0 },
+	[APL_OR]			= { 0,			1, 3, 3 },	// 1's from the first 1 on
+	[APL_UP_STILE]		= { 0,			1, 3, 3 },
+	[APL_LESS_THAN]		= { 0,			1, 3, 0 },	// Only the first 1
+	[APL_LT_OR_EQUAL]	= { ~0ULL,		0, 0, 3 },	// All but the first 0
+	[APL_GREATER_THAN]	= { EVEN_BITS,	0, 2, 2 },
+	[APL_GT_OR_EQUAL]	= { ODD_BITS,	1, 1, 1 },
+	[APL_NAND]			= { EVEN_BITS,	0, 2, 1 },
+	[APL_NOR]			= { ODD_BITS,	1, 1, 2 },
+};
+
+// Scan a packed boolean vector
+// Returns 0 if the function can't be done this way
+static int ScanBool(int fun)
+{
+	aplbits *psrc, *pdst;
+	aplbits word, carry, stops;
+	const STOPSCAN *pss;
+	int nelem, nwords, done, bit;
+
+	if (RANK(poprTop) != 1)
+		return 0;
+
+	nelem = SHAPE(poprTop)[0];
+	nwords = BOOL_WORDS(nelem);
+	psrc = VPTR(poprTop);
+
+	switch (fun) {
+	case APL_PLUS: {		// Running count
+		aplint *pint = TempAlloc(sizeof(aplint), nelem);
+		aplint count = 0;
+		for (int i = 0; i < nelem; ++i)
+			pint[i] = count += BOOL_GET(psrc, i);
+		TYPE(poprTop) = TINT;
+		VOFF(poprTop) = WKSOFF(pint);
+		return 1;
+	}
+	case APL_NOT_EQUAL:
+	case APL_EQUAL:
+		// Parity of the prefix; a=b=c... is the same as a≠b≠c...
+		// negated at odd positions
+		pdst = TempAlloc(sizeof(aplbits), nwords);
+		carry = 0;
+		for (int i = 0; i < nwords; ++i) {
+			word = psrc[i];
+			word ^= word << 1;
+			word ^= word << 2;
+			word ^= word << 4;
+			word ^= word << 8;
+			word ^= word << 16;
+			word ^= word << 32;
+			if (carry)
+				word = ~word;
+			carry = word >> 63;
+			pdst[i] = fun == APL_EQUAL ? word ^ ODD_BITS : word;
+		}
+		break;
+	case APL_AND:
+	case APL_TIMES:
+	case APL_DOWN_STILE:
+	case APL_OR:
+	case APL_UP_STILE:
+	case APL_LESS_THAN:
+	case APL_LT_OR_EQUAL:
+	case APL_GREATER_THAN:
+	case APL_GT_OR_EQUAL:
+	case APL_NAND:
+	case APL_NOR:
+		pss = &StopScans[fun];
+		pdst = TempAlloc(sizeof(aplbits), nwords);
+		done = 0;
+		for (int i = 0; i < nwords; ++i) {
+			if (done) {
+				pdst[i] = done > 1 ? ~(aplbits)0 : 0;
 				continue;
-			if (--shape[d]) {
-				pf += A.size[d];
-				break;
 			}
-			shape[d] = A.shape[d];
-			pf -= (shape[d] - 1) * A.size[d];
+			stops = pss->stop ? psrc[i] : ~psrc[i];
+			if (!stops) {
+				pdst[i] = pss->before;
+				continue;
+			}
+			// Words have an even number of bits, so the parity of
+			// the position of the stop is the parity of its bit
+			bit = __builtin_ctzll(stops);
+			word = pss->before & (((aplbits)1 << bit) - 1);
+			if ((pss->at >> (bit & 1)) & 1)
+				word |= (aplbits)1 << bit;
+			if ((pss->after >> (bit & 1)) & 1)
+				word |= ~(((aplbits)2 << bit) - 1);
+			pdst[i] = word;
+			done = 1 + ((pss->after >> (bit & 1)) & 1);
 		}
-	} while (d >= 0);
+		break;
+	default:
+		return 0;
+	}
+
+	// Clear unused bits
+	if (nelem & 63)
+		pdst[nwords - 1] &= ((aplbits)1 << (nelem & 63)) - 1;
+
+	VOFF(poprTop) = WKSOFF(pdst);
+
+	return 1;
+}
+
+// x fun y for the scans of comparisons
+static int ScanCompare(int fun, double x, double y)
+{
+	switch (fun) {
+	case APL_LESS_THAN:		return x < y;
+	case APL_EQUAL:			return x == y;
+	case APL_GREATER_THAN:	return x > y;
+	case APL_LT_OR_EQUAL:	return x <= y;
+	case APL_NOT_EQUAL:		return x != y;
+	case APL_GT_OR_EQUAL:	return x >= y;
+	case APL_NAND:			return !(x && y);
+	case APL_NOR:			return !(x || y);
+	}
+
+	return 0;
+}
+
+// a÷b÷c... for the n elements at px, stride apart, folded from the right
+static double ScanDivide(double *px, int n, int stride)
+{
+	double accum = px[(n - 1) * stride];
+
+	for (int l = n - 2; l >= 0; --l) {
+		if (accum == 0)
+			EvlError(EE_DIVIDE_BY_ZERO);
+		accum = px[l * stride] / accum;
+	}
+
+	return accum;
 }
 
 static void Scan(int fun, int axis)
@@ -4081,6 +6821,7 @@ static void Scan(int fun, int axis)
 	// If argument is not an array, leave it unchanged
 	if (!ISARRAY(poprTop))
 		return;
+	ViewExpand(poprTop);
 
 	// The only binary function that can be applied to characters is APL_EQUAL
 	// and to me it doesn't make much sense to compare an accumulated value to
@@ -4091,6 +6832,10 @@ static void Scan(int fun, int axis)
 	if (!ISNUMBER(poprTop))
 		EvlError(EE_DOMAIN);
 
+	if (TYPE(poprTop) == TBOOL && ScanBool(fun))
+		return;
+	ToDouble(poprTop);
+
 	rank = RANK(poprTop);
 
 	// Fill in shape[] and size[]
@@ -4133,8 +6878,6 @@ static void Scan(int fun, int axis)
 	case APL_TIMES:
 	case APL_AND:
 	case APL_OR:
-	case APL_NAND:
-	case APL_NOR:
 		left_assoc = 1;
 		break;
 	default:
@@ -4142,40 +6885,45 @@ static void Scan(int fun, int axis)
 		break;
 	}
 
-
 	if (left_assoc) {
-		// Left-associative functions (scan left->right once)
+		// Associative functions (scan left->right once)
+		KERNTASK task = { .fun = fun, .pz = pdst, .px = psrc, .n = shape[axis],
+			.stride = stride };
+		int n = shape[axis];
+
+		if (stride == 1 && n > POOL_GRAIN) {
+			// Long vectors are scanned in chunks
+			task.kernel = NumKernel(fun, KERN_SA);
+			task.pparts = TempAlloc(sizeof(double), (n + POOL_GRAIN - 1) / POOL_GRAIN);
+			for (int i = 0; i < outer[axis]; ++i) {
+				ScanVector(&task, n);
+				task.pz += inner;
+				task.px += inner;
+			}
+		} else if (stride == 1) {
+			PoolFor(ScanRowsTask, &task, outer[axis], POOL_GRAIN / n);
+		} else {
+			task.kernel = NumKernel(fun, KERN_AA);
+			PoolFor(ScanAxisTask, &task, outer[axis] * stride, POOL_GRAIN / n);
+		}
+	} else if (fun == APL_MINUS || fun == APL_DIV) {
+		// a-b-c-d... is a-b+c-d... and a÷b÷c÷d... is a÷b×c÷d...
 		for (int i = 0; i < outer[axis]; ++i) {
 			for (int j = 0; j < size[axis]; ++j) {
 				accum = *(psrc + j);
 				*(pdst + j) = accum;
 				for (int k = 1; k < shape[axis]; ++k) {
 					double arg = *(psrc + j + k * stride);
-					switch (fun) {
-					case APL_UP_STILE:
-						accum = max(accum,arg);
-						break;
-					case APL_DOWN_STILE:
-						accum = min(accum,arg);
-						break;
-					case APL_PLUS:
-						accum += arg;
-						break;
-					case APL_TIMES:
-						accum *= arg;
-						break;
-					case APL_AND:
-						accum = accum && arg;
-						break;
-					case APL_OR:
-						accum = accum || arg;
-						break;
-					case APL_NAND:
-						accum = !(accum && arg);
-						break;
-					case APL_NOR:
-						accum = !(accum || arg);
-						break;
+					if (fun == APL_MINUS)
+						accum += k & 1 ? -arg : arg;
+					else if (arg == 0)
+						EvlError(EE_DIVIDE_BY_ZERO);
+					else {
+						accum = k & 1 ? accum / arg : accum * arg;
+						// The product may overflow or underflow where the
+						// quotients don't; those prefixes are folded again
+						if (!isnormal(accum) && *(psrc + j) != 0)
+							accum = ScanDivide(psrc + j, k + 1, stride);
 					}
 					*(pdst + j + k * stride) = accum;
 				}
@@ -4183,8 +6931,31 @@ static void Scan(int fun, int axis)
 			psrc += inner;
 			pdst += inner;
 		}
+	} else if (IsBoolFun(fun)) {
+		// a f b f ... y f z: y f z is 0 or 1 and each element to its left
+		// acts on that as a constant, the identity or the negation. The
+		// composition of these, kept as its values at 0 and 1, grows by
+		// one element at a time from the left.
+		for (int i = 0; i < outer[axis]; ++i) {
+			for (int j = 0; j < size[axis]; ++j) {
+				double prev = *(psrc + j);
+				char comp[2] = { 0, 1 };
+				*(pdst + j) = prev;
+				for (int k = 1; k < shape[axis]; ++k) {
+					double arg = *(psrc + j + k * stride);
+					char c0 = comp[ScanCompare(fun, prev, 0)];
+					char c1 = comp[ScanCompare(fun, prev, 1)];
+					*(pdst + j + k * stride) = comp[ScanCompare(fun, prev, arg)];
+					comp[0] = c0;
+					comp[1] = c1;
+					prev = arg;
+				}
+			}
+			psrc += inner;
+			pdst += inner;
+		}
 	} else {
-		// Non-associative functions (scan right->left many times)
+		// Other functions (scan right->left many times)
 		for (int i = 0; i < outer[axis]; ++i) {
 			for (int j = 0; j < size[axis]; ++j) {
 				psrc += inner - stride;	// last element in sub-array
@@ -4333,20 +7104,28 @@ static void VarGetSys(ENV *penv)
 			*pchr++ = '0' + i;
 		break;
 	case SYS_DBG:	// Debug flags
-		OperPush(TNUM,0);
-		VNUM(poprTop) = g_dbg_flags;
+		OperPush(TINT,0);
+		VINT(poprTop) = g_dbg_flags;
 		break;
 	case SYS_IO:	// Index Origin
-		OperPush(TNUM,0);
-		VNUM(poprTop) = g_origin;
+		OperPush(TINT,0);
+		VINT(poprTop) = g_origin;
+		break;
+	case SYS_NT:	// Number of threads
+		OperPush(TINT,0);
+		VINT(poprTop) = g_num_threads;
 		break;
 	case SYS_PID:	// Process id
-		OperPush(TNUM,0);
-		VNUM(poprTop) = getpid();
+		OperPush(TINT,0);
+		VINT(poprTop) = getpid();
 		break;
 	case SYS_PP:	// Print Precision
-		OperPush(TNUM,0);
-		VNUM(poprTop) = g_print_prec;
+		OperPush(TINT,0);
+		VINT(poprTop) = g_print_prec;
+		break;
+	case SYS_RL:	// Random link
+		OperPush(TINT,0);
+		VINT(poprTop) = g_rand_seed;
 		break;
 	case SYS_TS:	// Timestamp
 		OperPush(TNUM,1);
@@ -4375,15 +7154,15 @@ static double NumValue()
 {
 	double num;
 
+	ToInt(poprTop);
 	if (!ISNUMBER(poprTop))
 		EvlError(EE_DOMAIN);
-	if (ISSCALAR(poprTop)) {
-		num = VNUM(poprTop);
-	} else {
-		if (RANK(poprTop) != 1 || SHAPE(poprTop)[0] != 1)
-			EvlError(EE_RANK);
+	if (!ISSCALAR(poprTop) && (RANK(poprTop) != 1 || SHAPE(poprTop)[0] != 1))
+		EvlError(EE_RANK);
+	if (TYPE(poprTop) == TINT)
+		num = (double)*(aplint *)VPTR(poprTop);
+	else
 		num = *(double *)VPTR(poprTop);
-	}
 
 	return num;
 }
@@ -4413,6 +7192,7 @@ static char *StrValue(int *plen)
 {
 	int len;
 
+	ViewExpand(poprTop);
 	if (!ISCHAR(poprTop))
 		EvlError(EE_DOMAIN);
 	if (ISSCALAR(poprTop))
@@ -4447,11 +7227,23 @@ static void VarSetSys(ENV *penv)
 		val = BoolValue();
 		g_origin = val;
 		break;
+	case SYS_NT:	// Number of threads
+		val = IntValue();
+		if (val < 1 || val > POOL_MAXTHREADS)
+			EvlError(EE_DOMAIN);
+		g_num_threads = val;
+		break;
 	case SYS_PP:	// Print Precision
 		val = IntValue();
 		if (val < 1 || val > 16)
 			EvlError(EE_DOMAIN);
-		g_print_prec = VNUM(poprTop);
+		g_print_prec = val;
+		break;
+	case SYS_RL:	// Random link
+		val = IntValue();
+		if (val < 0)
+			EvlError(EE_DOMAIN);
+		RandSeed(val);
 		break;
 	case SYS_WSID:	// WorkSpace ID
 		ptr = StrValue(&len);
@@ -4499,7 +7291,7 @@ static int IsNullArray(DESC *pd)
 		return 1;	// Canonical null array
 
 	// This is a null array if any of its axes has 0 elements
-	for (i = 0; i < RANK(pd); ++pd)
+	for (i = 0; i < RANK(pd); ++i)
 		if (!SHAPE(pd)[i])
 			return 1;
 
@@ -4513,17 +7305,16 @@ static int EvlBranchLine(int previous)
 	// The branch line depends on the type and
 	// value of the top expression
 
-	if (TYPE(poprTop) == TNUM) {
-		if (ISSCALAR(poprTop))
-			line = (int)VNUM(poprTop);
-		else {
-			if (IsNullArray(poprTop))
-				line = previous + 1;
-			else {
-				// Get first element of array
-				line = (int)*(double *)(WKSPTR(VOFF(poprTop)));
-			}
-		}
+	ToInt(poprTop);
+	if (ISNUMBER(poprTop)) {
+		if (IsNullArray(poprTop))
+			line = previous + 1;
+		else if (TYPE(poprTop) == TINT) {
+			// Get first element of array
+			aplint num = *(aplint *)VPTR(poprTop);
+			line = num < 0 || num > INT_MAX ? 0 : (int)num;
+		} else
+			line = (int)*(double *)VPTR(poprTop);
 	} else
 		line = 0;
 
@@ -4603,6 +7394,9 @@ static void EvlFunction(FUNCTION *pfun)
 	// Leave RET on the top (if present)
 	poprTop = env.pvarBase + pfun->nLocals + pfun->nArgs;
 
+	if (env.flags & EX_OWN_CELLS)
+		HeapFreeLocals(env.pvarBase, poprTop + pfun->nRet, pfun->nRet ? poprTop : NULL);
+
 	PopEnv(&env);
 }
 
@@ -4619,13 +7413,29 @@ static void VarSetInx(ENV *penv, int dims)
 	pd = penv->pvarBase + *penv->pCode++;
 
 	// Indexed assignment?
-	if (!dims)	// No, just copy the descriptor
+	if (!dims) {	// No, just copy the descriptor
+		// Views could see later changes to the viewed array
+		ViewExpand(poprTop);
 		*pd = *poprTop;
+	}
 	else {		// Yes
-		// We may need to create a copy of the value
-		// Not easy to optimize without a reference count...
+		// Locals never own heap cells: elements found in the heap
+		// belong to a global variable or to the function's literals,
+		// so they are copied before they change
+		if (ISEXTSTO(pd) && (char *)WKSPTR(VOFF(pd)) >= (char *)phepBase &&
+			(char *)WKSPTR(VOFF(pd)) < (char *)phepTop) {
+			int size = DataSize(pd);
+			void *ptr = TempAlloc(sizeof(double), (size + sizeof(double) - 1) / sizeof(double));
+
+			memcpy(ptr, VPTR(pd), size);
+			VOFF(pd) = WKSOFF(ptr);
+		} else if (ISEXTSTO(pd))
+			ViewDetach(pd);
+		ToInt(pd);
+		if (TYPE(pd) == TINT && TYPE(poprTop + dims) == TNUM)
+			ToDouble(pd);
 		OperPushDesc(pd);
-		EvlSetIndex(dims);
+		EvlSetIndex(pd, dims);
 	}
 }
 
@@ -4641,8 +7451,10 @@ void SetName(int len, char *name, DESC *pd)
 
 			pdold = (DESC *)WKSPTR(pn->odesc);
 			// Free old heap entry if any
-			if (ISARRAY(pdold) || ISFUNCT(pdold))
+			if (ISFUNCT(pdold))
 				AplHeapFree(VOFF(pdold));
+			else if (ISEXTSTO(pdold))
+				AplHeapRelease(pdold);
 			GlobalDescFree(pdold);
 		}
 	} else
@@ -4655,8 +7467,7 @@ void SetName(int len, char *name, DESC *pd)
 static void VarSetNam(ENV *penv, int dims)
 {
 	int len;
-	int oldsize, newsize;
-	offset off;
+	int oldsize;
 	VNAME *pn;
 	DESC *pd;
 
@@ -4672,7 +7483,7 @@ static void VarSetNam(ENV *penv, int dims)
 	// If we still don't have a descriptor, get one
 	if (pn->odesc) {
 		pd = (DESC *)WKSPTR(pn->odesc);
-		oldsize = NumElem(pd) * (ISNUMBER(pd) ? sizeof(double) : sizeof(char));
+		oldsize = DataSize(pd);
 	} else {
 		if (dims)
 			EvlError(EE_UNDEFINED_VAR);
@@ -4681,40 +7492,113 @@ static void VarSetNam(ENV *penv, int dims)
 		oldsize = 0;
 	}
 
-	penv->pCode += len;
+	penv->pCode += len;
+
+	// The old elements are about to change or be freed
+	if (oldsize && ISEXTSTO(pd))
+		ViewDetach(pd);
+
+	// Indexed assignment?
+	if (dims) {
+		// Yes; the elements are stored in place and the cached type
+		// remains the same unless an integer array receives
+		// floating-point values. Both have the same size, so the
+		// elements are converted in place. Packed booleans and narrow
+		// integers are expanded only if the new values don't fit;
+		// progressions always are. Elements shared with other names
+		// are copied before they change.
+		if (ISEXTSTO(pd))
+			HeapUnshare(pd);
+		ToInt(poprTop + dims);
+		if (TYPE(pd) == TAP || ((TYPE(pd) == TBOOL || ISNARROW(pd)) &&
+			!IntFits(poprTop + dims, TYPE(pd)))) {
+			OperPushDesc(pd);
+			ToInt(poprTop);
+			VarStore(pd, oldsize);
+			pn->type = TINT;
+			POP(poprTop);
+		}
+		if (TYPE(pd) == TINT && TYPE(poprTop + dims) == TNUM) {
+			aplint *pint = VPTR(pd);
+			double *pdbl = VPTR(pd);
+			int nelem = NumElem(pd);
+
+			for (int i = 0; i < nelem; ++i)
+				pdbl[i] = (double)pint[i];
+			pn->type = TYPE(pd) = TNUM;
+		}
+		OperPushDesc(pd);
+		EvlSetIndex(pd, dims);
+		return;
+	}
+
+	// Keep integer arrays in the narrowest width
+	ViewExpand(poprTop);
+	IntSqueeze(poprTop);
+
+	// Cache value type in name table
+	pn->type = TYPE(poprTop);
+	VarStore(pd, oldsize);
+}
+
+// Size in bytes of the elements of an array
+static int DataSize(DESC *pd)
+{
+	int nelem = NumElem(pd);
+
+	switch (TYPE(pd)) {
+	case TBOOL:	return BOOL_WORDS(nelem) * sizeof(aplbits);
+	case TAP:	return 2 * sizeof(aplint);	// First element and step
+	case TCHR:	return nelem * sizeof(char);
+	default:	return nelem * INT_WIDTH(TYPE(pd));
+	}
+}
+
+// Copy the value on the top of the stack to global descriptor pd
+// oldsize is the size of the current contents of pd (0 if none)
+static void VarStore(DESC *pd, int oldsize)
+{
+	int newsize;
+	offset off;
+	HEAPCELL *pc;
 
-	// Indexed assignment?
-	if (dims) {
-		// Yes; the cached type remains the same
-		OperPushDesc(pd);
-		EvlSetIndex(dims);
+	newsize = DataSize(poprTop);
+
+	// The value is another global variable (B←A); share its heap
+	// cell instead of copying the elements
+	if (ISEXTSTO(poprTop) && (pc = HeapCell(VOFF(poprTop))) != NULL) {
+		if (!oldsize || !ISEXTSTO(pd) || VOFF(pd) != VOFF(poprTop)) {
+			++pc->refcnt;
+			if (oldsize && ISEXTSTO(pd))
+				AplHeapRelease(pd);
+		}
+		*pd = *poprTop;
 		return;
 	}
 
-	// Cache value type in name table
-	pn->type = TYPE(poprTop);
-	newsize = NumElem(poprTop) * (ISNUMBER(poprTop) ? sizeof(double) : sizeof(char));
-
 	if (oldsize) {	// Previously defined
 		int cmpsto = CMP_STORAGE(pd,poprTop);
 		off = VOFF(pd);				// We may need to release this block
-		*pd = *poprTop;
 		switch (cmpsto) {	// Old : New
 		case CMP_INT_INT:
+			*pd = *poprTop;
 			return;					// Nothing else to do
 		case CMP_INT_EXT:
 			off = 0;
 			break;
 		case CMP_EXT_INT:
-			AplHeapFree(off);		// Release old block
+			AplHeapRelease(pd);		// Release old block
+			*pd = *poprTop;
 			return;
 		case CMP_EXT_EXT:
-			if (oldsize != newsize) {	// If not the same size, realloc
-				AplHeapFree(off);
+			// If not the same size or shared, realloc
+			if (oldsize != newsize || ((HEAPCELL *)WKSPTR(off - sizeof(HEAPCELL)))->refcnt > 1) {
+				AplHeapRelease(pd);
 				off = 0;
 			}
 			break;
 		}
+		*pd = *poprTop;
 	} else {	// Previously undefined
 		*pd = *poprTop;
 		if (ISINTSTO(pd))
@@ -4730,6 +7614,121 @@ static void VarSetNam(ENV *penv, int dims)
 	memcpy(WKSPTR(off), WKSPTR(VOFF(poprTop)), newsize);
 }
 
+// V←V,X where V is a vector and X a scalar or vector of the same type
+// (or of integers that fit into V). The elements of X are appended to
+// V in place; V gets a heap cell with room to spare, so that building
+// a vector element by element takes linear time.
+// On entry X is on the top and pCode points to the comma. Returns 0 if
+// the expression doesn't have this form; nothing is changed then.
+// Locals never own heap cells otherwise, so the ones they get here are
+// freed when the function returns (see HeapFreeLocals).
+static int VarAppend(ENV *penv)
+{
+	char *p = penv->pCode + 1;
+	char *pnext;
+	HEAPCELL *pc;
+	DESC *pd, old;
+	VNAME *pn = NULL;
+	int len, t, size, n, k;
+	offset off;
+
+	// Find V, which must appear on both sides of ←
+	if (*p == APL_VARNAM) {
+		len = p[1];
+		if (p[len + 2] != APL_LEFT_ARROW || p[len + 3] != APL_VARNAM ||
+			p[len + 4] != len || memcmp(p + 2, p + len + 5, len))
+			return 0;
+		pn = GetName(len, p + 2);
+		if (!pn || !pn->odesc || !IS_VARIABLE(pn))
+			return 0;
+		pd = (DESC *)WKSPTR(pn->odesc);
+		pnext = p + 2 * len + 5;
+	} else if (*p == APL_VARINX) {
+		if (p[2] != APL_LEFT_ARROW || p[3] != APL_VARINX || p[4] != p[1])
+			return 0;
+		pd = penv->pvarBase + p[1];
+		pnext = p + 5;
+	} else
+		return 0;
+
+	// Check types
+	t = TYPE(pd);
+	if (RANK(pd) != 1 || RANK(poprTop) > 1)
+		return 0;
+	ViewExpand(poprTop);
+	ToInt(poprTop);
+	if (t == TCHR) {
+		if (TYPE(poprTop) != TCHR)
+			return 0;
+		size = sizeof(char);
+	} else if (t == TNUM) {
+		if (!ISNUMBER(poprTop))
+			return 0;
+		ToDouble(poprTop);
+		size = sizeof(double);
+	} else if (ISINTEGER(t)) {
+		if (!IntFits(poprTop, t))
+			return 0;
+		size = INT_WIDTH(t);
+	} else
+		return 0;
+
+	n = SHAPE(pd)[0];
+	k = NumElem(poprTop);
+
+	// Does V own a heap cell? If so, is there enough room?
+	pc = (HEAPCELL *)((char *)VPTR(pd) - sizeof(HEAPCELL));
+	if (!ISEXTSTO(pd) || pc < phepBase || pc >= phepTop ||
+		pc->refcnt != 1 || pc->follow != WKSOFF(pd))
+		pc = NULL;
+	old = *pd;
+	if (!pc || pc->length - sizeof(HEAPCELL) < (n + k) * size) {
+		// Get a new cell with twice the room needed
+		off = AplHeapAlloc(max(2 * (n + k) * size, HEAPMINBLOCK), WKSOFF(pd));
+		memcpy(WKSPTR(off), VPTR(pd), n * size);
+		VOFF(pd) = off;
+		if (pn == NULL) {
+			penv->flags |= EX_OWN_CELLS;
+			++nLocalCells;
+		}
+	}
+
+	// Append X
+	if (t == TCHR || t == TNUM)
+		memcpy((char *)VPTR(pd) + n * size, VPTR(poprTop), k * size);
+	else {
+		aplint *psrc = VPTR(poprTop);
+		for (int i = 0; i < k; ++i)
+			switch (size) {
+			case 1:	((int8_t *)VPTR(pd))[n + i] = (int8_t)psrc[i]; break;
+			case 2:	((int16_t *)VPTR(pd))[n + i] = (int16_t)psrc[i]; break;
+			case 4:	((int32_t *)VPTR(pd))[n + i] = (int32_t)psrc[i]; break;
+			case 8:	((aplint *)VPTR(pd))[n + i] = psrc[i]; break;
+			}
+	}
+	SHAPE(pd)[0] = n + k;
+
+	// X may have been the old value of V, so the old cell is only
+	// released now. The old cell of a local is kept until the function
+	// returns if some other value on the stack still uses it.
+	if (pn && ISEXTSTO(&old) && VOFF(&old) != VOFF(pd)) {
+		ViewDetach(&old);
+		off = VOFF(pd);
+		VOFF(pd) = VOFF(&old);
+		AplHeapRelease(pd);
+		VOFF(pd) = off;
+	} else if (!pn && pc && !HeapCellUsed(pc, pd)) {
+		AplHeapFree(VOFF(&old));
+		--nLocalCells;
+	}
+
+	// Leave the new value of V on the top
+	*poprTop = *pd;
+	penv->pCode = pnext;
+
+	return 1;
+}
+
 VNAME *GetName(int len, char *pName)
 {
 	offset off;
@@ -4832,11 +7831,19 @@ void DescPrint(DESC *popr)
 	double num;
 	double *pdbl;
 
+	ViewExpand(popr);
+
 	if (RANK(poprTop) > 1)	// Give more room to higher dimensional arrays
 		print_line("\n");
 
 	switch (TYPE(popr)) {
+	case TINT:
+	case TI8:
+	case TI16:
+	case TI32:
+	case TAP:
 	case TNUM:
+	case TBOOL:
 		FormatOut();
 		break;
 
@@ -4916,6 +7923,7 @@ static void SysIdent(void)
 
 	if (!ISNUMBER(poprTop))
 		EvlError(EE_DOMAIN);
+	ToDouble(poprTop);
 	if (ISSCALAR(poprTop))
 		n = (int)VNUM(poprTop);
 	else {
@@ -4949,6 +7957,7 @@ static void SysLU(void)
 	// Must be a square numeric matrix
 	if (!ISNUMBER(poprTop))
 		EvlError(EE_DOMAIN);
+	ToDouble(poprTop);
 	if (RANK(poprTop) != 2  ||  SHAPE(poprTop)[0] != SHAPE(poprTop)[1])
 		EvlError(EE_RANK);
 
@@ -4980,6 +7989,7 @@ static void SysRref(void)
 
 	if (!ISNUMBER(poprTop))
 		EvlError(EE_DOMAIN);
+	ToDouble(poprTop);
 	if (!ISARRAY(poprTop) || RANK(poprTop) != 2)
 		EvlError(EE_RANK);
 
@@ -5024,6 +8034,9 @@ static void ArrayInfo(ARRAYINFO *pai)
 	int rank = RANK(pd);
 	int nelem = 1;
 
+	// Elements must be contiguous
+	ViewExpand(pd);
+
 	// Copy shape and any possible local elements
 	COPY_SHAPE(SHAPE(pai), SHAPE(pd), MAXDIM);
 	// Pointer to first element
@@ -5054,6 +8067,145 @@ static void ArrayInfo(ARRAYINFO *pai)
 	pai->type  = TYPE(pd);
 	pai->rank  = rank;
 	pai->nelem = nelem;
+
+	switch (pai->type) {
+	case TBOOL:
+	case TAP:	pai->width = 0;					break;
+	case TCHR:	pai->width = sizeof(char);		break;
+	default:	pai->width = INT_WIDTH(pai->type);	break;
+	}
+}
+
+// Turn pd into a view of its elements and return the view
+// Returns NULL (and leaves pd unchanged) if pd can't be viewed
+static VIEW *ViewOf(DESC *pd)
+{
+	VIEW *pv;
+	int nelem;
+
+	if (TYPE(pd) != TVIEW) {
+		if (!ISARRAY(pd) || !ISEXTSTO(pd))
+			return NULL;
+		if (TYPE(pd) != TINT && TYPE(pd) != TNUM && TYPE(pd) != TCHR)
+			return NULL;
+	}
+
+	pv = TempAlloc(sizeof(double), (sizeof(VIEW) + sizeof(double) - 1) / sizeof(double));
+
+	if (TYPE(pd) == TVIEW)	// Views may be shared, so they are copied
+		*pv = *(VIEW *)VPTR(pd);
+	else {
+		pv->doff = VOFF(pd);
+		pv->type = TYPE(pd);
+		nelem = 1;
+		for (int i = RANK(pd) - 1; i >= 0; --i) {
+			pv->stride[i] = nelem;
+			nelem *= SHAPE(pd)[i];
+		}
+	}
+
+	TYPE(pd) = TVIEW;
+	VOFF(pd) = WKSOFF(pv);
+
+	return pv;
+}
+
+// Copy the elements of a view to contiguous storage
+static void ViewExpand(DESC *pd)
+{
+	VIEW *pv;
+	int index[MAXDIM];
+	int rank, nelem, size, len;
+	ptrdiff_t step;
+	char *psrc, *pdst;
+
+	if (TYPE(pd) != TVIEW)
+		return;
+
+	pv = VPTR(pd);
+	rank = RANK(pd);
+	nelem = NumElem(pd);
+	size = pv->type == TCHR ? sizeof(char) : sizeof(double);
+	TYPE(pd) = pv->type;
+	VOFF(pd) = 0;
+	if (!nelem)
+		return;
+
+	pdst = TempAlloc(size, nelem);
+	VOFF(pd) = WKSOFF(pdst);
+	psrc = WKSPTR(pv->doff);
+
+	// One row (last axis) at a time
+	len = SHAPE(pd)[rank - 1];
+	step = (ptrdiff_t)pv->stride[rank - 1] * size;
+	for (int i = 0; i < rank; ++i)
+		index[i] = 0;
+
+	for (;;) {
+		if (step == size) {			// Contiguous row
+			memcpy(pdst, psrc, len * size);
+			pdst += len * size;
+		} else if (size == sizeof(char)) {
+			for (int j = 0; j < len; ++j)
+				*pdst++ = psrc[j * step];
+		} else {
+			for (int j = 0; j < len; ++j, pdst += size)
+				*(double *)pdst = *(double *)(psrc + j * step);
+		}
+
+		// Next row
+		int d;
+		for (d = rank - 2; d >= 0; --d) {
+			psrc += (ptrdiff_t)pv->stride[d] * size;
+			if (++index[d] < SHAPE(pd)[d])
+				break;
+			psrc -= (ptrdiff_t)pv->stride[d] * size * SHAPE(pd)[d];
+			index[d] = 0;
+		}
+		if (d < 0)
+			break;
+	}
+}
+
+// Take or drop along the first n axes of the top of the stack
+// Returns 0 if the result can't be a view
+static int ViewTakeDrop(int *spec, int n, int drop)
+{
+	DESC *pd = poprTop;
+	VIEW *pv;
+	int len[MAXDIM];	// New length of each axis
+	int skip[MAXDIM];	// # of elements skipped at the start of each axis
+	int size;
+
+	if (!ISARRAY(pd) || n > RANK(pd))
+		return 0;
+
+	for (int i = 0; i < n; ++i) {
+		int shape = SHAPE(pd)[i];
+		int k = abs(spec[i]);
+		if (drop) {
+			len[i] = k < shape ? shape - k : 0;
+			skip[i] = spec[i] > 0 ? k : 0;
+		} else {
+			if (k > shape)
+				return 0;	// Needs padding
+			len[i] = k;
+			skip[i] = spec[i] < 0 ? shape - k : 0;
+		}
+		if (!len[i])
+			return 0;		// Null result
+	}
+
+	if (!(pv = ViewOf(pd)))
+		return 0;
+
+	size = pv->type == TCHR ? sizeof(char) : sizeof(double);
+	for (int i = 0; i < n; ++i) {
+		pv->doff += (ptrdiff_t)skip[i] * pv->stride[i] * size;
+		SHAPE(pd)[i] = len[i];
+	}
+
+	return 1;
 }
 
 // Extend shape of array with new axis with length 1
@@ -5067,7 +8219,7 @@ static void ExtendArray(ARRAYINFO *pai, int axis)
 	// If using internal storage, copy elements to temp stack
 	char *pold = pai->vptr;
 	if (pold > (char *)pai && pold < ((char *)pai + sizeof(ARRAYINFO))) {
-		int size = pai->type == TNUM ? sizeof(double) : sizeof(char);
+		int size = pai->type != TCHR ? sizeof(double) : sizeof(char);
 		char *pnew = TempAlloc(size, pai->nelem);
 		memcpy(pnew, pold, size * pai->nelem);
 		pai->vptr = pnew;
@@ -5106,7 +8258,7 @@ static void ExtendScalar(ARRAYINFO *psrc, ARRAYINFO *pdst, int axis)
 	// Need to copy scalar to temp stack?
 	if (rank > MINDIM) {
 		// Yes; free space in shape[]
-		if (pdst->type == TNUM) {
+		if (pdst->type != TCHR) {
 			double *pnew = TempAlloc(sizeof(double), 1);
 			*pnew = *(double *)pdst->vptr;
 			pdst->vptr = pnew;
@@ -5199,6 +8351,77 @@ static int Conformable(DESC *pv1, DESC *pv2)
 	return TRUE;
 }
 
+// Bytes *plo..*phi-1 of the workspace hold the elements of pd
+static void DataRange(DESC *pd, char **plo, char **phi)
+{
+	VIEW *pv;
+	long lo, hi, d;
+	int size;
+
+	if (TYPE(pd) != TVIEW) {
+		*plo = VPTR(pd);
+		*phi = *plo + DataSize(pd);
+		return;
+	}
+
+	// Strides may be negative
+	pv = VPTR(pd);
+	size = pv->type == TCHR ? sizeof(char) : sizeof(double);
+	lo = hi = 0;
+	for (int i = 0; i < RANK(pd); ++i) {
+		d = (long)(SHAPE(pd)[i] - 1) * pv->stride[i];
+		if (d < 0)
+			lo += d;
+		else
+			hi += d;
+	}
+	*plo = (char *)WKSPTR(pv->doff) + lo * size;
+	*phi = (char *)WKSPTR(pv->doff) + (hi + 1) * size;
+}
+
+// Most temporary arrays die as soon as the next function has read them,
+// like X×2 in 1+X×2, so scalar functions write their results over such
+// an argument instead of taking more of the array stack. Arrays on the
+// array stack may also be held by local variables, which keep their
+// values there, and be seen through views. Both live on the operand
+// stack, below the arguments of the function that is running.
+// Returns 1 if the size bytes at ptr are part of the array stack and no
+// descriptor from pfrom to the bottom of the operand stack uses them.
+static int IsDeadTemp(void *ptr, int size, DESC *pfrom)
+{
+	char *lo, *hi;
+
+	if ((char *)ptr < parrTop || (char *)ptr + size > parrBase)
+		return 0;
+
+	for (DESC *pd = pfrom; pd < pdesBase; ++pd) {
+		if (!(ISNUMBER(pd) || ISCHAR(pd) || TYPE(pd) == TVIEW) || !ISEXTSTO(pd))
+			continue;
+		DataRange(pd, &lo, &hi);
+		if (lo < (char *)ptr + size && (char *)ptr < hi)
+			return 0;
+	}
+
+	return 1;
+}
+
+// Values on the operand stack may be views of the elements of a
+// variable, like ⌽A in (A←B)+⌽A. Before those elements change or are
+// freed, such views are copied to the array stack.
+static void ViewDetach(DESC *pd)
+{
+	char *lo, *hi, *vlo, *vhi;
+
+	DataRange(pd, &lo, &hi);
+	for (DESC *p = poprTop; p < pdesBase; ++p) {
+		if (TYPE(p) != TVIEW)
+			continue;
+		DataRange(p, &vlo, &vhi);
+		if (vlo < hi && lo < vhi)
+			ViewExpand(p);
+	}
+}
+
 void *TempAlloc(int size, int nItems)
 {
 	char *pstk;
@@ -5206,12 +8429,13 @@ void *TempAlloc(int size, int nItems)
 	// Align at the proper boundary
 	pstk = (char *)ALIGN_DOWN(parrTop, size);
 
-	size *= nItems;
+	// Progressions like ⍳1E9 may ask for more bytes than an int holds
+	size_t bytes = (size_t)size * (size_t)nItems;
 
-	if (pstk - size <= (char *)pgblTop)
+	if (bytes >= (size_t)(pstk - (char *)pgblTop))
 		EvlError(EE_ARRAY_OVERFLOW);
 
-	parrTop = pstk - size;
+	parrTop = pstk - bytes;
 
 	return (void *)parrTop;
 }
@@ -5277,6 +8501,7 @@ offset AplHeapAlloc(int size, offset off)
 			pr->follow = WKSOFF((char *)pc + size);
 			pr = (HEAPCELL *)((char *)pc + size);
 			pr->length = extra;
+			pr->refcnt = 0;
 		}
 		pr->follow = pc->follow;	// Remove block from the free list
 	} else {	// Get new block from the heap
@@ -5289,10 +8514,123 @@ offset AplHeapAlloc(int size, offset off)
 	}
 
 	pc->follow = off;
+	pc->refcnt = 1;
 
 	return WKSOFF((char *)pc + sizeof(HEAPCELL));
 }
 
+// Return the heap cell that holds the elements of a global
+// variable or NULL if offset 'off' points somewhere else
+static HEAPCELL *HeapCell(offset off)
+{
+	HEAPCELL *pc;
+	DESC *pd;
+
+	pc = (HEAPCELL *)WKSPTR(off - sizeof(HEAPCELL));
+	if (pc < phepBase || pc >= phepTop || !pc->refcnt || !pc->follow)
+		return NULL;
+
+	// The owner must be a global descriptor that points back here
+	pd = (DESC *)WKSPTR(pc->follow);
+	if (pd < pdesBase || pd >= pgblTop || VOFF(pd) != off)
+		return NULL;
+
+	return pc;
+}
+
+// Drop the reference that global descriptor pd holds to its
+// heap cell and free the cell if nobody else is sharing it
+void AplHeapRelease(DESC *pd)
+{
+	HEAPCELL *pc;
+	DESC *p;
+	offset off = VOFF(pd);
+
+	pc = (HEAPCELL *)WKSPTR(off - sizeof(HEAPCELL));
+	if (--pc->refcnt == 0) {
+		AplHeapFree(off);
+		return;
+	}
+
+	// Still shared; pass ownership on to another descriptor
+	if (pc->follow == WKSOFF(pd)) {
+		for (p = pdesBase; p < pgblTop; ++p)
+			if (p != pd && VOFF(p) == off && ISEXTSTO(p))
+				break;
+		pc->follow = p < pgblTop ? WKSOFF(p) : 0;
+	}
+}
+
+// Whether a value on the operand stack other than pd
+// (directly or through a view) uses heap cell pc
+static int HeapCellUsed(HEAPCELL *pc, DESC *pd)
+{
+	char *pbeg = (char *)pc + sizeof(HEAPCELL);
+	char *pend = (char *)pc + pc->length;
+	char *ptr;
+
+	for (DESC *p = poprTop; p < pdesBase; ++p) {
+		if (p == pd || !ISEXTSTO(p))
+			continue;
+		if (TYPE(p) == TVIEW)
+			ptr = WKSPTR(((VIEW *)VPTR(p))->doff);
+		else
+			ptr = VPTR(p);
+		if (ptr >= pbeg && ptr < pend)
+			return 1;
+	}
+
+	return 0;
+}
+
+// Free the heap cells owned by the local descriptors in [pfirst,plast).
+// If the value in pret uses one of them it's moved to the array stack.
+static void HeapFreeLocals(DESC *pfirst, DESC *plast, DESC *pret)
+{
+	HEAPCELL *pc, *pnext;
+	offset first = WKSOFF(pfirst);
+	offset last = WKSOFF(plast);
+	char *pdata;
+
+	for (pc = phepBase; pc < phepTop; pc = pnext) {
+		pnext = (HEAPCELL *)((char *)pc + pc->length);
+		if (!pc->refcnt || pc->follow < first || pc->follow >= last)
+			continue;
+
+		pdata = (char *)pc + sizeof(HEAPCELL);
+		if (pret && ISEXTSTO(pret) && (char *)VPTR(pret) >= pdata && (char *)VPTR(pret) < (char *)pnext) {
+			int size = DataSize(pret);
+			void *ptr = TempAlloc(sizeof(double), (size + sizeof(double) - 1) / sizeof(double));
+
+			memcpy(ptr, VPTR(pret), size);
+			VOFF(pret) = WKSOFF(ptr);
+		}
+
+		AplHeapFree(WKSOFF(pdata));
+		--nLocalCells;
+	}
+}
+
+// Give global descriptor pd a private copy of its elements
+// before they are changed in place (copy-on-write)
+static void HeapUnshare(DESC *pd)
+{
+	HEAPCELL *pc;
+	offset off = VOFF(pd);
+	offset new;
+	int size;
+
+	pc = (HEAPCELL *)WKSPTR(off - sizeof(HEAPCELL));
+	if (pc->refcnt == 1)
+		return;
+
+	size = DataSize(pd);
+	new = AplHeapAlloc(size, WKSOFF(pd));
+	memcpy(WKSPTR(new), WKSPTR(off), size);
+	AplHeapRelease(pd);
+	VOFF(pd) = new;
+}
+
 void AplHeapFree(offset off)
 {
 	HEAPCELL *pf;	// Block to free
@@ -5302,6 +8640,7 @@ void AplHeapFree(offset off)
 
 	pf = (HEAPCELL *)WKSPTR(off - sizeof(HEAPCELL));
 	pf->follow = 0;
+	pf->refcnt = 0;
 
 	// If we're freeing the top block, simply adjust phepTop
 	if ((char *)pf + pf->length == (char *)phepTop) {
@@ -5383,11 +8722,279 @@ double *DoubleAlloc(DESC *pd, size_t nelem)
 	return ptr;
 }
 
+aplint *IntAlloc(DESC *pd, size_t nelem)
+{
+	// Same size as doubles
+	return (aplint *)DoubleAlloc(pd, nelem);
+}
+
+// Allocate a packed boolean array with all elements = 0
+aplbits *BoolAlloc(DESC *pd, size_t nelem)
+{
+	int nwords = BOOL_WORDS(nelem);
+	aplbits *ptr = (aplbits *)DoubleAlloc(pd, nwords);
+
+	memset(ptr, 0, nwords * sizeof(aplbits));
+
+	return ptr;
+}
+
+// Unpack a boolean array into integers
+static void BoolToInt(DESC *pd)
+{
+	if (TYPE(pd) != TBOOL)
+		return;
+
+	aplbits *pbits = VPTR(pd);
+	int nelem = NumElem(pd);
+	aplint *pint = TempAlloc(sizeof(aplint), nelem);
+
+	for (int i = 0; i < nelem; ++i)
+		pint[i] = BOOL_GET(pbits, i);
+
+	VOFF(pd) = WKSOFF(pint);
+	TYPE(pd) = TINT;
+}
+
+// Convert a narrow integer array or a progression to 64-bit integers
+static void IntWiden(DESC *pd)
+{
+	if (TYPE(pd) == TAP) {
+		aplint *pap = VPTR(pd);
+		aplint num = AP_BASE(pap);
+		aplint step = AP_STEP(pap);
+		int nelem = SHAPE(pd)[0];
+		aplint *pint = TempAlloc(sizeof(aplint), nelem);
+
+		for (int i = 0; i < nelem; ++i, num += step)
+			pint[i] = num;
+
+		VOFF(pd) = WKSOFF(pint);
+		TYPE(pd) = TINT;
+		return;
+	}
+
+	if (!ISNARROW(pd))
+		return;
+
+	void *pold = VPTR(pd);
+	int width = INT_WIDTH(TYPE(pd));
+	int nelem = NumElem(pd);
+	aplint *pint = TempAlloc(sizeof(aplint), nelem);
+
+	for (int i = 0; i < nelem; ++i)
+		pint[i] = IntElem(pold, width, i);
+
+	VOFF(pd) = WKSOFF(pint);
+	TYPE(pd) = TINT;
+}
+
+// Copy views to contiguous storage and convert packed booleans,
+// narrow integers and progressions to 64-bit integers
+static void ToInt(DESC *pd)
+{
+	ViewExpand(pd);
+	BoolToInt(pd);
+	IntWiden(pd);
+}
+
+// Squeeze an integer array to the narrowest width that holds its elements
+static void IntSqueeze(DESC *pd)
+{
+	aplint *pint, lo, hi;
+	int nelem, type;
+
+	if (TYPE(pd) != TINT || !ISARRAY(pd) || !(nelem = NumElem(pd)))
+		return;
+
+	pint = VPTR(pd);
+	lo = hi = pint[0];
+	for (int i = 1; i < nelem; ++i) {
+		if (pint[i] < lo) lo = pint[i];
+		else if (pint[i] > hi) hi = pint[i];
+	}
+
+	if (lo >= INT8_MIN && hi <= INT8_MAX) {
+		int8_t *pnew = TempAlloc(sizeof(int8_t), nelem);
+		for (int i = 0; i < nelem; ++i)
+			pnew[i] = (int8_t)pint[i];
+		VOFF(pd) = WKSOFF(pnew);
+		type = TI8;
+	} else if (lo >= INT16_MIN && hi <= INT16_MAX) {
+		int16_t *pnew = TempAlloc(sizeof(int16_t), nelem);
+		for (int i = 0; i < nelem; ++i)
+			pnew[i] = (int16_t)pint[i];
+		VOFF(pd) = WKSOFF(pnew);
+		type = TI16;
+	} else if (lo >= INT32_MIN && hi <= INT32_MAX) {
+		int32_t *pnew = TempAlloc(sizeof(int32_t), nelem);
+		for (int i = 0; i < nelem; ++i)
+			pnew[i] = (int32_t)pint[i];
+		VOFF(pd) = WKSOFF(pnew);
+		type = TI32;
+	} else
+		return;
+
+	TYPE(pd) = type;
+}
+
+// Whether all elements of pd are integers that can be
+// stored in a boolean or integer array of type 'type'
+static int IntFits(DESC *pd, int type)
+{
+	aplint *pint, lo, hi;
+	int nelem;
+
+	if (TYPE(pd) != TINT)
+		return 0;
+
+	switch (type) {
+	case TBOOL:	lo = 0;			hi = 1;			break;
+	case TI8:	lo = INT8_MIN;	hi = INT8_MAX;	break;
+	case TI16:	lo = INT16_MIN;	hi = INT16_MAX;	break;
+	case TI32:	lo = INT32_MIN;	hi = INT32_MAX;	break;
+	default:	return 1;
+	}
+
+	pint = VPTR(pd);
+	nelem = NumElem(pd);
+	for (int i = 0; i < nelem; ++i)
+		if (pint[i] < lo || pint[i] > hi)
+			return 0;
+
+	return 1;
+}
+
+// Number of 1's in a range of a boolean array
+static int BoolCount(aplbits *pbits, int start, int len)
+{
+	int count = 0;
+
+	while (len > 0) {
+		int bit = start & 63;
+		int n = min(64 - bit, len);
+		aplbits word = pbits[start >> 6] >> bit;
+		if (n < 64)
+			word &= ((aplbits)1 << n) - 1;
+		count += __builtin_popcountll(word);
+		start += n;
+		len -= n;
+	}
+
+	return count;
+}
+
+// Convert an integer array to doubles
+static double *IntToDouble(aplint *pint, int nelem)
+{
+	double *pdbl = TempAlloc(sizeof(double), nelem);
+
+	for (int i = 0; i < nelem; ++i)
+		pdbl[i] = (double)pint[i];
+
+	return pdbl;
+}
+
+// Convert an integer argument to doubles
+// Internal storage is converted in place. Other arrays may be
+// shared with variables or literals, so they are copied.
+static void ToDouble(DESC *pd)
+{
+	ToInt(pd);
+
+	if (TYPE(pd) != TINT)
+		return;
+
+	if (ISINTSTO(pd)) {
+		aplint *pint = VPTR(pd);
+		double *pdbl = VPTR(pd);
+		int nelem = NumElem(pd);
+
+		for (int i = 0; i < nelem; ++i)
+			pdbl[i] = (double)pint[i];
+	} else
+		VOFF(pd) = WKSOFF(IntToDouble(VPTR(pd), NumElem(pd)));
+
+	TYPE(pd) = TNUM;
+}
+
+// Same as ToDouble() but only changes the array info
+static void InfoToDouble(ARRAYINFO *pai)
+{
+	if (pai->type == TBOOL) {
+		double *pdbl = TempAlloc(sizeof(double), pai->nelem);
+
+		for (int i = 0; i < pai->nelem; ++i)
+			pdbl[i] = BOOL_GET((aplbits *)pai->vptr, i);
+		pai->vptr = pdbl;
+		pai->type = TNUM;
+	}
+
+	if (pai->type == TAP) {
+		double *pdbl = TempAlloc(sizeof(double), pai->nelem);
+		aplint num = AP_BASE(pai->vptr);
+		aplint step = AP_STEP(pai->vptr);
+
+		for (int i = 0; i < pai->nelem; ++i, num += step)
+			pdbl[i] = (double)num;
+		pai->vptr = pdbl;
+		pai->type = TNUM;
+	}
+
+	if (ISNARROW(pai)) {
+		double *pdbl = TempAlloc(sizeof(double), pai->nelem);
+
+		for (int i = 0; i < pai->nelem; ++i)
+			pdbl[i] = (double)IntElem(pai->vptr, pai->width, i);
+		pai->vptr = pdbl;
+		pai->type = TNUM;
+	}
+
+	if (pai->type != TINT)
+		return;
+
+	pai->vptr = IntToDouble(pai->vptr, pai->nelem);
+	pai->type = TNUM;
+}
+
+// Same as InfoToDouble() for 64-bit integers that nothing else uses
+// (see IsDeadTemp), which are converted in place
+static void TempToDouble(ARRAYINFO *pai)
+{
+	aplint *pint = pai->vptr;
+	double *pdbl = pai->vptr;
+
+	if (pai->type != TINT)
+		return;
+
+	for (int i = 0; i < pai->nelem; ++i)
+		pdbl[i] = (double)pint[i];
+	pai->type = TNUM;
+}
+
 int *AsInt(DESC *pd, int nelem)
 {
 	int *pint = TempAlloc(sizeof(int), nelem);
 	double *pdbl = VPTR(pd);
 
+	if (TYPE(pd) == TBOOL) {
+		for (int i = 0; i < nelem; ++i)
+			pint[i] = BOOL_GET((aplbits *)pdbl, i);
+		return pint;
+	}
+
+	if (ISINTEGER(TYPE(pd))) {
+		int width = INT_WIDTH(TYPE(pd));
+
+		for (int i = 0; i < nelem; ++i) {
+			aplint num = IntElem(pdbl, width, i);
+			if (num < INT_MIN || num > INT_MAX)
+				EvlError(EE_DOMAIN);
+			pint[i] = (int)num;
+		}
+		return pint;
+	}
+
 	for (int i = 0; i < nelem; ++i) {
 		int elem = pdbl[i];
 		if ((double)elem != pdbl[i])
@@ -5400,6 +9007,9 @@ int *AsInt(DESC *pd, int nelem)
 
 void EvlError(int errnum)
 {
+	// Errors in other threads are raised later by the main thread
+	PoolError(errnum);
+
 #ifdef	HAVE_ANSI_CODES
 	print_line("\n[EvalError] ");
 	ansi_magenta();
@@ -5432,8 +9042,7 @@ void EvlError(int errnum)
 	print_line("\n");
 
 	// Reset evaluation stacks
-	poprTop = pdesBase;
-	parrTop = parrBase;
+	EvlResetStacks();
 	g_penv = 0;
 	LONGJUMP();
 }
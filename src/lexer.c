@@ -38,8 +38,10 @@ NameIndex SysNames[] = {
 	{ "ident",		APL_SYSFUN1,	SYS_IDENT	},
 	{ "io",			APL_VARSYS,		SYS_IO		},
 	{ "lu",			APL_SYSFUN1,	SYS_LU		},
+	{ "nt",			APL_VARSYS,		SYS_NT		},
 	{ "pid",		APL_VARSYS,		SYS_PID		},
 	{ "pp",			APL_VARSYS,		SYS_PP		},
+	{ "rl",			APL_VARSYS,		SYS_RL		},
 	{ "rref",		APL_SYSFUN1,	SYS_RREF	},
 	{ "ts",			APL_VARSYS,		SYS_TS		},
 	{ "ver",		APL_VARSYS,		SYS_VER		},
@@ -53,9 +55,10 @@ static void EmitArray(LEXER *plex);
 static void EmitName(LEXER *plex);
 static void EmitString(LEXER *plex);
 static void EmitSysName(LEXER *plex);
+static int	IntLiterals(double *plit, int n);
 static void TokExponent(LEXER *plex);
 static void TokFraction(LEXER *plex);
-static int  TokInteger(LEXER *plex);
+static double TokInteger(LEXER *plex);
 static void TokName(LEXER *plex);
 static void TokNumber(LEXER *plex);
 static void TokString(LEXER *plexid);
@@ -318,7 +321,7 @@ static void TokNumber(LEXER *plex)
 		plex->tokNum = 0.0;
 		TokFraction(plex);
 	} else {
-		plex->tokNum = (double)TokInteger(plex);
+		plex->tokNum = TokInteger(plex);
 		if (plex->lexChr == '.') {
 			NextChr(plex);
 			TokFraction(plex);
@@ -335,9 +338,9 @@ static void TokNumber(LEXER *plex)
 	++plex->plitTop;
 }
 
-static int TokInteger(LEXER *plex)
+static double TokInteger(LEXER *plex)
 {
-	int val = 0;
+	double val = 0;	// Exact up to 2^53
 
 	while (isdigit(plex->lexChr)) {
 		val = val * 10 + (plex->lexChr - '0');
@@ -456,6 +459,21 @@ void TokPrint(char *base, double *litBase)
 			print_line("\n");
 			break;
 
+		case APL_INT:
+			tok = *++pc;
+			print_line("INT=%lld\n", (long long)*(aplint *)(litBase + tok));
+			break;
+
+		case APL_IARR:
+			print_line("IARR=");
+			n = *++pc;
+			tok = *++pc;
+			pdbl = litBase + tok;
+			while (n--)
+				print_line("%lld ", (long long)*(aplint *)pdbl++);
+			print_line("\n");
+			break;
+
 		case APL_STR:
 			n = *++pc;
 			print_line("STR=%.*s\n", n, pc+1);
@@ -551,11 +569,11 @@ static void TokName(LEXER *plex)
 
 static void EmitArray(LEXER *plex)
 {
-	int n, indx;
+	int n, indx, isint;
 
 	/*
-	** Scalar: [APL_NUM] [INDX]
-	** Vector: [APL_ARR] [DIMS] [INDX]
+	** Scalar: [APL_NUM] [INDX]   or [APL_INT]  [INDX]
+	** Vector: [APL_ARR] [DIMS] [INDX] or [APL_IARR] [DIMS] [INDX]
 	*/
 
 	indx = plex->litIndx - 1;
@@ -565,13 +583,32 @@ static void EmitArray(LEXER *plex)
 
 	EmitTok(plex,indx);
 
-	if ((n = plex->litIndx - indx) > 1)	// Vector
+	n = plex->litIndx - indx;
+	isint = IntLiterals(plex->plitBase + indx, n);
+
+	if (n > 1)						// Vector
 	{
 		EmitTok(plex,n);
-		EmitTok(plex,APL_ARR);
+		EmitTok(plex,isint ? APL_IARR : APL_ARR);
 	}
 	else							/* Scalar */
-		EmitTok(plex,APL_NUM);
+		EmitTok(plex,isint ? APL_INT : APL_NUM);
+}
+
+// If all 'n' literals are integers, store them as such
+// (replacing the doubles) and return TRUE.
+static int IntLiterals(double *plit, int n)
+{
+	int i;
+
+	for (i = 0; i < n; ++i)
+		if (plit[i] != floor(plit[i]) || fabs(plit[i]) >= 0x1p63)
+			return FALSE;
+
+	for (i = 0; i < n; ++i)
+		*(aplint *)(plit + i) = (aplint)plit[i];
+
+	return TRUE;
 }
 
 static void EmitName(LEXER *plex)
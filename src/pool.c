@@ -0,0 +1,168 @@
+// Released under the MIT License; see LICENSE
+// Copyright (c) 2021 José Cordeiro
+
+// Worker threads for data-parallel loops. PoolFor() splits a range of
+// items into chunks of a fixed size and the main thread and up to ⎕NT-1
+// workers take chunks until there are none left. The chunks depend only
+// on the size of the range, never on the number of threads, so callers
+// that combine one partial result per chunk get the same answer with
+// any ⎕NT. An error raised while a chunk runs (see EvlError) stops that
+// chunk only; the main thread raises the first of them in chunk order
+// when all chunks are done.
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "apl.h"
+#include "error.h"
+
+static pthread_t		Workers[POOL_MAXTHREADS];
+static int				nWorkers;		// Workers started so far
+static pthread_mutex_t	PoolMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	WorkCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t	DoneCond = PTHREAD_COND_INITIALIZER;
+
+// The loop being run
+static POOLTASK	Task;
+static void	*	pTaskArg;
+static int		nItems;			// # of items in the range
+static int		Grain;			// # of items per chunk
+static int		nChunks;
+static int		NextChunk;		// Next chunk to be taken
+static int		nHelpers;		// # of workers that may help
+static int		nBusy;			// # of workers still helping
+static unsigned	Generation;		// Incremented for every loop
+static int		ErrChunk;		// First chunk that failed
+static int		ErrNum;			// and its error
+
+// Set while this thread runs a chunk
+static __thread jmp_buf	*pChunkJump;
+static __thread int		CurChunk;
+
+// Run chunks until there are none left
+static void RunChunks(void)
+{
+	jmp_buf jb;
+	int chunk, start;
+
+	for (;;) {
+		pthread_mutex_lock(&PoolMutex);
+		chunk = NextChunk < nChunks ? NextChunk++ : -1;
+		pthread_mutex_unlock(&PoolMutex);
+		if (chunk < 0)
+			return;
+
+		start = chunk * Grain;
+		CurChunk = chunk;
+		if (!setjmp(jb)) {
+			pChunkJump = &jb;
+			Task(pTaskArg, start, min(start + Grain, nItems));
+		}
+		pChunkJump = NULL;
+	}
+}
+
+static void *WorkerMain(void *parg)
+{
+	int id = (int)(intptr_t)parg;
+	unsigned gen = 0;
+
+	pthread_mutex_lock(&PoolMutex);
+	for (;;) {
+		while (Generation == gen)
+			pthread_cond_wait(&WorkCond, &PoolMutex);
+		gen = Generation;
+		if (id >= nHelpers)
+			continue;
+		pthread_mutex_unlock(&PoolMutex);
+
+		RunChunks();
+
+		pthread_mutex_lock(&PoolMutex);
+		if (--nBusy == 0)
+			pthread_cond_signal(&DoneCond);
+	}
+
+	return NULL;
+}
+
+// Called by EvlError(). If this thread is running a chunk, the error
+// is recorded and the chunk abandoned; otherwise it returns.
+void PoolError(int errnum)
+{
+	if (!pChunkJump)
+		return;
+
+	pthread_mutex_lock(&PoolMutex);
+	if (CurChunk < ErrChunk) {
+		ErrChunk = CurChunk;
+		ErrNum = errnum;
+	}
+	pthread_mutex_unlock(&PoolMutex);
+
+	longjmp(*pChunkJump, 1);
+}
+
+// Number of threads used by default: one per processor
+void PoolInit(void)
+{
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+	g_num_threads = ncpu < 1 ? 1 : min(ncpu, POOL_MAXTHREADS);
+}
+
+// Call task(parg, start, end) for consecutive chunks of grain items
+// that cover 0..n-1, in parallel when there is more than one chunk.
+// Returns the number of chunks.
+int PoolFor(POOLTASK task, void *parg, int n, int grain)
+{
+	int nchunks, nhelpers;
+
+	if (grain < 1)
+		grain = 1;
+	nchunks = n > grain ? (n + grain - 1) / grain : 1;
+	nhelpers = min(g_num_threads, nchunks) - 1;
+
+	if (nhelpers <= 0) {
+		// Same chunks, one after the other
+		for (int i = 0; i < nchunks; ++i)
+			task(parg, i * grain, min((i + 1) * grain, n));
+		return nchunks;
+	}
+
+	pthread_mutex_lock(&PoolMutex);
+	while (nWorkers < nhelpers) {
+		if (pthread_create(&Workers[nWorkers], NULL, WorkerMain,
+			(void *)(intptr_t)nWorkers))
+			break;
+		++nWorkers;
+	}
+	nhelpers = min(nhelpers, nWorkers);
+
+	Task = task;
+	pTaskArg = parg;
+	nItems = n;
+	Grain = grain;
+	nChunks = nchunks;
+	NextChunk = 0;
+	nHelpers = nhelpers;
+	nBusy = nhelpers;
+	ErrChunk = nchunks;
+	++Generation;
+	pthread_cond_broadcast(&WorkCond);
+	pthread_mutex_unlock(&PoolMutex);
+
+	RunChunks();
+
+	pthread_mutex_lock(&PoolMutex);
+	while (nBusy)
+		pthread_cond_wait(&DoneCond, &PoolMutex);
+	pthread_mutex_unlock(&PoolMutex);
+
+	if (ErrChunk < nchunks)
+		EvlError(ErrNum);
+
+	return nchunks;
+}
@@ -0,0 +1,125 @@
+// Released under the MIT License; see LICENSE
+// Copyright (c) 2021 José Cordeiro
+
+// Random numbers for roll and deal. The generator is xoshiro256**, whose
+// state is set from ⎕RL through splitmix64, so that setting ⎕RL repeats
+// the same numbers. Integers below some N are drawn without the bias of
+// taking a remainder (Lemire's method, which rarely needs a division).
+// Large rolls are split into chunks that get generators of their own
+// (see RandSplit), so they give the same numbers with any ⎕NT.
+
+#include <math.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "apl.h"
+#include "error.h"
+
+RANDGEN	g_rand;			// Main generator
+int		g_rand_seed;	// ⎕RL
+
+static uint64_t SplitMix(uint64_t *px)
+{
+	uint64_t z = (*px += 0x9E3779B97F4A7C15ULL);
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+static void RandInit(RANDGEN *pg, uint64_t x)
+{
+	for (int i = 0; i < 4; ++i)
+		pg->s[i] = SplitMix(&x);
+}
+
+static inline uint64_t RotL(uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t Next(RANDGEN *pg)
+{
+	uint64_t *s = pg->s;
+	uint64_t res = RotL(s[1] * 5, 7) * 9;
+	uint64_t t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = RotL(s[3], 45);
+
+	return res;
+}
+
+// Integer in 0..n-1 (n > 0)
+static inline uint64_t Below(RANDGEN *pg, uint64_t n)
+{
+	unsigned __int128 m = (unsigned __int128)Next(pg) * n;
+	uint64_t low = (uint64_t)m;
+
+	// Reject the few products that would favour some results
+	if (low < n) {
+		uint64_t min = -n % n;
+		while (low < min) {
+			m = (unsigned __int128)Next(pg) * n;
+			low = (uint64_t)m;
+		}
+	}
+
+	return (uint64_t)(m >> 64);
+}
+
+uint64_t RandNext(RANDGEN *pg)
+{
+	return Next(pg);
+}
+
+uint64_t RandBelow(RANDGEN *pg, uint64_t n)
+{
+	return Below(pg, n);
+}
+
+// Seed the main generator with a seed of 0 or more (⎕RL rejects negative
+// ones). A seed of 0 picks one from the clock and the process id, which
+// ⎕RL then returns.
+void RandSeed(int seed)
+{
+	struct timeval tv;
+
+	while (!seed) {
+		gettimeofday(&tv, NULL);
+		seed = (int)((tv.tv_sec * 1000003 + tv.tv_usec) ^ getpid()) & INT32_MAX;
+	}
+
+	g_rand_seed = seed;
+	RandInit(&g_rand, (uint64_t)(aplint)seed);
+}
+
+// Generator of chunk index of a roll. base is drawn from the main
+// generator once for the whole roll.
+void RandSplit(RANDGEN *pg, uint64_t base, int index)
+{
+	uint64_t x = base + (uint64_t)index;
+
+	RandInit(pg, SplitMix(&x));
+}
+
+// ?px[i] for n elements: ?0 is a number in [0,1) and ?N an integer
+// in ⍳N. pz and px may be the same.
+void RandRoll(RANDGEN *pg, double *pz, double *px, int n)
+{
+	for (int i = 0; i < n; ++i) {
+		double num = px[i];
+
+		if (num < 0 || num != floor(num) || num > 9007199254740992.0)
+			EvlError(EE_DOMAIN);
+		if (num)
+			pz[i] = (double)Below(pg, (uint64_t)num) + g_origin;
+		else
+			pz[i] = (double)(Next(pg) >> 11) * 0x1.0p-53;
+	}
+}
@@ -0,0 +1,759 @@
+// Released under the MIT License; see LICENSE
+// Copyright (c) 2021 José Cordeiro
+
+// SSE2 and AVX2 kernels of the most common dyadic scalar functions, of
+// their reductions and of the exponential, logarithm, sine and cosine.
+// The CPU is probed once at startup and the best kernels it supports
+// replace the portable ones in eval.c. Other targets keep the portable
+// kernels. Like those, these kernels only collect domain errors inside
+// the loops (as vector masks) and raise them at the end.
+
+#include "apl.h"
+#include "error.h"
+#include "token.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+
+#include <float.h>
+#include <immintrin.h>
+#include <math.h>
+#include <string.h>
+
+// Generates the SA, AS and AA kernels of a function for one instruction
+// set, W doubles at a time. X and Y are the vector arguments, B the mask
+// of bad elements; x and y are the scalar arguments for the tail.
+#define	VEC_KERNEL(attr, V, W, LOAD, STORE, SET1, ZERO, OR, MOVEMASK,	\
+				   name, vexpr, vbad, expr, bad, err)				\
+attr static void name##SA(double *pz, double *px, double *py, int n)	\
+{																	\
+	V X = SET1(*px), Y, B = ZERO();									\
+	double x = *px, y;												\
+	int i, fail = 0;												\
+	for (i = 0; i + W <= n; i += W) {								\
+		Y = LOAD(py + i);											\
+		B = OR(B, vbad);											\
+		STORE(pz + i, vexpr);										\
+	}																\
+	for (; i < n; ++i) {											\
+		y = py[i];													\
+		fail |= (bad);												\
+		pz[i] = (expr);												\
+	}																\
+	if (fail | MOVEMASK(B))											\
+		EvlError(err);												\
+}																	\
+attr static void name##AS(double *pz, double *px, double *py, int n)	\
+{																	\
+	V X, Y = SET1(*py), B = ZERO();									\
+	double x, y = *py;												\
+	int i, fail = 0;												\
+	for (i = 0; i + W <= n; i += W) {								\
+		X = LOAD(px + i);											\
+		B = OR(B, vbad);											\
+		STORE(pz + i, vexpr);										\
+	}																\
+	for (; i < n; ++i) {											\
+		x = px[i];													\
+		fail |= (bad);												\
+		pz[i] = (expr);												\
+	}																\
+	if (fail | MOVEMASK(B))											\
+		EvlError(err);												\
+}																	\
+attr static void name##AA(double *pz, double *px, double *py, int n)	\
+{																	\
+	V X, Y, B = ZERO();												\
+	double x, y;													\
+	int i, fail = 0;												\
+	for (i = 0; i + W <= n; i += W) {								\
+		X = LOAD(px + i);											\
+		Y = LOAD(py + i);											\
+		B = OR(B, vbad);											\
+		STORE(pz + i, vexpr);										\
+	}																\
+	for (; i < n; ++i) {											\
+		x = px[i];													\
+		y = py[i];													\
+		fail |= (bad);												\
+		pz[i] = (expr);												\
+	}																\
+	if (fail | MOVEMASK(B))											\
+		EvlError(err);												\
+}
+
+#define	SSE_KERNEL(name, vexpr, vbad, expr, bad, err)				\
+	VEC_KERNEL(, __m128d, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_set1_pd,	\
+		_mm_setzero_pd, _mm_or_pd, _mm_movemask_pd,					\
+		name, vexpr, vbad, expr, bad, err)
+
+#define	AVX_KERNEL(name, vexpr, vbad, expr, bad, err)				\
+	VEC_KERNEL(__attribute__((target("avx2"))), __m256d, 4,			\
+		_mm256_loadu_pd, _mm256_storeu_pd, _mm256_set1_pd,			\
+		_mm256_setzero_pd, _mm256_or_pd, _mm256_movemask_pd,			\
+		name, vexpr, vbad, expr, bad, err)
+
+// Comparisons give 1.0 or 0.0 by masking the bits of 1.0
+#define	SSE_ONE		_mm_set1_pd(1.0)
+#define	SSE_ZERO	_mm_setzero_pd()
+#define	SSE_CMP(op,a,b)		_mm_and_pd(_mm_cmp##op##_pd(a, b), SSE_ONE)
+#define	SSE_NOT_BOOL(a)		\
+	_mm_and_pd(_mm_cmpneq_pd(a, SSE_ZERO), _mm_cmpneq_pd(a, SSE_ONE))
+#define	SSE_BOOL_BAD	_mm_or_pd(SSE_NOT_BOOL(X), SSE_NOT_BOOL(Y))
+
+#define	AVX_ONE		_mm256_set1_pd(1.0)
+#define	AVX_ZERO	_mm256_setzero_pd()
+#define	AVX_CMP(op,a,b)		_mm256_and_pd(_mm256_cmp_pd(a, b, op), AVX_ONE)
+#define	AVX_NEZ(a)			_mm256_cmp_pd(a, AVX_ZERO, _CMP_NEQ_UQ)
+#define	AVX_NOT_BOOL(a)		\
+	_mm256_and_pd(AVX_NEZ(a), _mm256_cmp_pd(a, AVX_ONE, _CMP_NEQ_UQ))
+#define	AVX_BOOL_BAD	_mm256_or_pd(AVX_NOT_BOOL(X), AVX_NOT_BOOL(Y))
+
+// Same as NOT_BOOL() in eval.c
+#define	NOT_BOOL(x,y)	((((x) != 0) & ((x) != 1)) | (((y) != 0) & ((y) != 1)))
+
+// max_pd(a,b) and min_pd(a,b) return b when a == b; the arguments are
+// swapped so that ¯0⌈0 gives the same ¯0 as the portable kernels.
+SSE_KERNEL(SseMax,	_mm_max_pd(Y, X),	B,	max(x, y),	0,	0)
+SSE_KERNEL(SseMin,	_mm_min_pd(Y, X),	B,	min(x, y),	0,	0)
+SSE_KERNEL(SsePlus,	_mm_add_pd(X, Y),	B,	x + y,		0,	0)
+SSE_KERNEL(SseMinus,	_mm_sub_pd(X, Y),	B,	x - y,		0,	0)
+SSE_KERNEL(SseTimes,	_mm_mul_pd(X, Y),	B,	x * y,		0,	0)
+SSE_KERNEL(SseDiv,	_mm_div_pd(X, Y),	_mm_cmpeq_pd(Y, SSE_ZERO),
+	x / y,	y == 0,	EE_DIVIDE_BY_ZERO)
+SSE_KERNEL(SseAnd,	_mm_and_pd(_mm_and_pd(_mm_cmpneq_pd(X, SSE_ZERO),
+	_mm_cmpneq_pd(Y, SSE_ZERO)), SSE_ONE), SSE_BOOL_BAD,
+	(x != 0) & (y != 0), NOT_BOOL(x, y), EE_DOMAIN)
+SSE_KERNEL(SseOr,	_mm_and_pd(_mm_or_pd(_mm_cmpneq_pd(X, SSE_ZERO),
+	_mm_cmpneq_pd(Y, SSE_ZERO)), SSE_ONE), SSE_BOOL_BAD,
+	(x != 0) | (y != 0), NOT_BOOL(x, y), EE_DOMAIN)
+SSE_KERNEL(SseLt,	SSE_CMP(lt, X, Y),	B,	x < y,		0,	0)
+SSE_KERNEL(SseLe,	SSE_CMP(le, X, Y),	B,	x <= y,		0,	0)
+SSE_KERNEL(SseEq,	SSE_CMP(eq, X, Y),	B,	x == y,		0,	0)
+SSE_KERNEL(SseGe,	SSE_CMP(ge, X, Y),	B,	x >= y,		0,	0)
+SSE_KERNEL(SseGt,	SSE_CMP(gt, X, Y),	B,	x > y,		0,	0)
+SSE_KERNEL(SseNe,	SSE_CMP(neq, X, Y),	B,	x != y,		0,	0)
+
+AVX_KERNEL(AvxMax,	_mm256_max_pd(Y, X),	B,	max(x, y),	0,	0)
+AVX_KERNEL(AvxMin,	_mm256_min_pd(Y, X),	B,	min(x, y),	0,	0)
+AVX_KERNEL(AvxPlus,	_mm256_add_pd(X, Y),	B,	x + y,		0,	0)
+AVX_KERNEL(AvxMinus,	_mm256_sub_pd(X, Y),	B,	x - y,		0,	0)
+AVX_KERNEL(AvxTimes,	_mm256_mul_pd(X, Y),	B,	x * y,		0,	0)
+AVX_KERNEL(AvxDiv,	_mm256_div_pd(X, Y),	_mm256_cmp_pd(Y, AVX_ZERO, _CMP_EQ_OQ),
+	x / y,	y == 0,	EE_DIVIDE_BY_ZERO)
+AVX_KERNEL(AvxAnd,	_mm256_and_pd(_mm256_and_pd(AVX_NEZ(X), AVX_NEZ(Y)), AVX_ONE),
+	AVX_BOOL_BAD, (x != 0) & (y != 0), NOT_BOOL(x, y), EE_DOMAIN)
+AVX_KERNEL(AvxOr,	_mm256_and_pd(_mm256_or_pd(AVX_NEZ(X), AVX_NEZ(Y)), AVX_ONE),
+	AVX_BOOL_BAD, (x != 0) | (y != 0), NOT_BOOL(x, y), EE_DOMAIN)
+AVX_KERNEL(AvxLt,	AVX_CMP(_CMP_LT_OQ, X, Y),	B,	x < y,	0,	0)
+AVX_KERNEL(AvxLe,	AVX_CMP(_CMP_LE_OQ, X, Y),	B,	x <= y,	0,	0)
+AVX_KERNEL(AvxEq,	AVX_CMP(_CMP_EQ_OQ, X, Y),	B,	x == y,	0,	0)
+AVX_KERNEL(AvxGe,	AVX_CMP(_CMP_GE_OQ, X, Y),	B,	x >= y,	0,	0)
+AVX_KERNEL(AvxGt,	AVX_CMP(_CMP_GT_OQ, X, Y),	B,	x > y,	0,	0)
+AVX_KERNEL(AvxNe,	AVX_CMP(_CMP_NEQ_UQ, X, Y),	B,	x != y,	0,	0)
+
+// Integer kernels return 0 on overflow instead of raising an error,
+// so that the caller can start over with doubles. The vector 'bad'
+// expressions set the sign bit of the elements that overflowed.
+#define	VEC_INT_KERNEL(attr, V, W, LOAD, STORE, SET1, ZERO, OR, MOVEMASK,	\
+					   name, vexpr, vbad, expr, bad)					\
+attr static int name##SA(aplint *pz, aplint *px, aplint *py, int n)	\
+{																	\
+	V X = SET1(*px), Y, Z, B = ZERO();								\
+	aplint x = *px, y, z;											\
+	int i, fail = 0;												\
+	for (i = 0; i + W <= n; i += W) {								\
+		Y = LOAD(py + i);											\
+		Z = (vexpr);												\
+		B = OR(B, vbad);											\
+		STORE(pz + i, Z);											\
+	}																\
+	for (; i < n; ++i) {											\
+		y = py[i];													\
+		z = (expr);													\
+		fail |= (bad);												\
+		pz[i] = z;													\
+	}																\
+	return !(fail | MOVEMASK(B));									\
+}																	\
+attr static int name##AS(aplint *pz, aplint *px, aplint *py, int n)	\
+{																	\
+	V X, Y = SET1(*py), Z, B = ZERO();								\
+	aplint x, y = *py, z;											\
+	int i, fail = 0;												\
+	for (i = 0; i + W <= n; i += W) {								\
+		X = LOAD(px + i);											\
+		Z = (vexpr);												\
+		B = OR(B, vbad);											\
+		STORE(pz + i, Z);											\
+	}																\
+	for (; i < n; ++i) {											\
+		x = px[i];													\
+		z = (expr);													\
+		fail |= (bad);												\
+		pz[i] = z;													\
+	}																\
+	return !(fail | MOVEMASK(B));									\
+}																	\
+attr static int name##AA(aplint *pz, aplint *px, aplint *py, int n)	\
+{																	\
+	V X, Y, Z, B = ZERO();											\
+	aplint x, y, z;													\
+	int i, fail = 0;												\
+	for (i = 0; i + W <= n; i += W) {								\
+		X = LOAD(px + i);											\
+		Y = LOAD(py + i);											\
+		Z = (vexpr);												\
+		B = OR(B, vbad);											\
+		STORE(pz + i, Z);											\
+	}																\
+	for (; i < n; ++i) {											\
+		x = px[i];													\
+		y = py[i];													\
+		z = (expr);													\
+		fail |= (bad);												\
+		pz[i] = z;													\
+	}																\
+	return !(fail | MOVEMASK(B));									\
+}
+
+#define	SSE_LOADI(p)		_mm_loadu_si128((__m128i *)(p))
+#define	SSE_STOREI(p,v)		_mm_storeu_si128((__m128i *)(p), v)
+#define	SSE_MOVEMASKI(v)	_mm_movemask_pd(_mm_castsi128_pd(v))
+#define	AVX_LOADI(p)		_mm256_loadu_si256((__m256i *)(p))
+#define	AVX_STOREI(p,v)		_mm256_storeu_si256((__m256i *)(p), v)
+#define	AVX_MOVEMASKI(v)	_mm256_movemask_pd(_mm256_castsi256_pd(v))
+
+#define	SSE_INT_KERNEL(name, vexpr, vbad, expr, bad)				\
+	VEC_INT_KERNEL(, __m128i, 2, SSE_LOADI, SSE_STOREI, _mm_set1_epi64x,	\
+		_mm_setzero_si128, _mm_or_si128, SSE_MOVEMASKI,				\
+		name, vexpr, vbad, expr, bad)
+
+#define	AVX_INT_KERNEL(name, vexpr, vbad, expr, bad)				\
+	VEC_INT_KERNEL(__attribute__((target("avx2"))), __m256i, 4,		\
+		AVX_LOADI, AVX_STOREI, _mm256_set1_epi64x,					\
+		_mm256_setzero_si256, _mm256_or_si256, AVX_MOVEMASKI,		\
+		name, vexpr, vbad, expr, bad)
+
+// Wrapping sums and differences; they overflowed when the sign of
+// the result is wrong
+#define	ADD(x,y)		(aplint)((uint64_t)(x) + (uint64_t)(y))
+#define	SUB(x,y)		(aplint)((uint64_t)(x) - (uint64_t)(y))
+#define	ADD_BAD(x,y,z)	((((x) ^ (z)) & ((y) ^ (z))) < 0)
+#define	SUB_BAD(x,y,z)	((((x) ^ (y)) & ((x) ^ (z))) < 0)
+
+SSE_INT_KERNEL(SseIntPlus,	_mm_add_epi64(X, Y),
+	_mm_and_si128(_mm_xor_si128(X, Z), _mm_xor_si128(Y, Z)),
+	ADD(x, y), ADD_BAD(x, y, z))
+SSE_INT_KERNEL(SseIntMinus,	_mm_sub_epi64(X, Y),
+	_mm_and_si128(_mm_xor_si128(X, Y), _mm_xor_si128(X, Z)),
+	SUB(x, y), SUB_BAD(x, y, z))
+
+#define	AVX_ONEI		_mm256_set1_epi64x(1)
+#define	AVX_GT(a,b)		_mm256_cmpgt_epi64(a, b)
+#define	AVX_EQ(a,b)		_mm256_cmpeq_epi64(a, b)
+#define	AVX_CMPI(m)		_mm256_and_si256(m, AVX_ONEI)
+#define	AVX_NCMPI(m)	_mm256_andnot_si256(m, AVX_ONEI)
+// Not blendv_epi8(), which GCC miscompiles with -fno-signed-char
+#define	AVX_SELECT(m,a,b)	\
+	_mm256_or_si256(_mm256_and_si256(m, a), _mm256_andnot_si256(m, b))
+
+AVX_INT_KERNEL(AvxIntPlus,	_mm256_add_epi64(X, Y),
+	_mm256_and_si256(_mm256_xor_si256(X, Z), _mm256_xor_si256(Y, Z)),
+	ADD(x, y), ADD_BAD(x, y, z))
+AVX_INT_KERNEL(AvxIntMinus,	_mm256_sub_epi64(X, Y),
+	_mm256_and_si256(_mm256_xor_si256(X, Y), _mm256_xor_si256(X, Z)),
+	SUB(x, y), SUB_BAD(x, y, z))
+AVX_INT_KERNEL(AvxIntMax,	AVX_SELECT(AVX_GT(X, Y), X, Y),	B,	max(x, y),	0)
+AVX_INT_KERNEL(AvxIntMin,	AVX_SELECT(AVX_GT(X, Y), Y, X),	B,	min(x, y),	0)
+AVX_INT_KERNEL(AvxIntLt,	AVX_CMPI(AVX_GT(Y, X)),		B,	x < y,	0)
+AVX_INT_KERNEL(AvxIntLe,	AVX_NCMPI(AVX_GT(X, Y)),	B,	x <= y,	0)
+AVX_INT_KERNEL(AvxIntEq,	AVX_CMPI(AVX_EQ(X, Y)),		B,	x == y,	0)
+AVX_INT_KERNEL(AvxIntGe,	AVX_NCMPI(AVX_GT(Y, X)),	B,	x >= y,	0)
+AVX_INT_KERNEL(AvxIntGt,	AVX_CMPI(AVX_GT(X, Y)),		B,	x > y,	0)
+AVX_INT_KERNEL(AvxIntNe,	AVX_NCMPI(AVX_EQ(X, Y)),	B,	x != y,	0)
+
+// Folds of associative functions, in the same order as ACC_FOLD() in
+// eval.c: eight accumulators in W-wide registers, which are then stored
+// and combined like the portable ones. Short arguments are folded from
+// right to left.
+#define	VEC_FOLD(attr, V, W, LOAD, STORE, name, vexpr, expr)	\
+attr static double name(double *px, int n)						\
+{																\
+	V A[8 / W], X, Y;											\
+	double acc[8], x, y;										\
+	int i, j;													\
+	if (n < 16) {												\
+		for (y = px[n - 1], i = n - 2; i >= 0; --i) {			\
+			x = px[i];											\
+			y = (expr);											\
+		}														\
+		return y;												\
+	}															\
+	for (j = 0; j < 8 / W; ++j)									\
+		A[j] = LOAD(px + j * W);								\
+	for (i = 8; i + 8 <= n; i += 8)								\
+		for (j = 0; j < 8 / W; ++j) {							\
+			X = A[j];											\
+			Y = LOAD(px + i + j * W);							\
+			A[j] = (vexpr);										\
+		}														\
+	for (j = 0; j < 8 / W; ++j)									\
+		STORE(acc + j * W, A[j]);								\
+	for (int w = 4; w; w /= 2)									\
+		for (j = 0; j < w; ++j) {								\
+			x = acc[j];											\
+			y = acc[j + w];										\
+			acc[j] = (expr);									\
+		}														\
+	for (x = acc[0]; i < n; ++i) {								\
+		y = px[i];												\
+		x = (expr);												\
+	}															\
+	return x;													\
+}
+
+#define	SSE_FOLD(name, vexpr, expr)								\
+	VEC_FOLD(, __m128d, 2, _mm_loadu_pd, _mm_storeu_pd, name, vexpr, expr)
+
+#define	AVX_FOLD(name, vexpr, expr)								\
+	VEC_FOLD(__attribute__((target("avx2"))), __m256d, 4,		\
+		_mm256_loadu_pd, _mm256_storeu_pd, name, vexpr, expr)
+
+SSE_FOLD(SseMaxF,	_mm_max_pd(Y, X),	max(x, y))
+SSE_FOLD(SseMinF,	_mm_min_pd(Y, X),	min(x, y))
+SSE_FOLD(SsePlusF,	_mm_add_pd(X, Y),	x + y)
+SSE_FOLD(SseTimesF,	_mm_mul_pd(X, Y),	x * y)
+
+AVX_FOLD(AvxMaxF,	_mm256_max_pd(Y, X),	max(x, y))
+AVX_FOLD(AvxMinF,	_mm256_min_pd(Y, X),	min(x, y))
+AVX_FOLD(AvxPlusF,	_mm256_add_pd(X, Y),	x + y)
+AVX_FOLD(AvxTimesF,	_mm256_mul_pd(X, Y),	x * y)
+
+static int HasAvx2(void)
+{
+	static int avx2 = -1;
+
+	if (avx2 < 0) {
+		__builtin_cpu_init();
+		avx2 = __builtin_cpu_supports("avx2") != 0;
+	}
+
+	return avx2;
+}
+
+#define	SET(k,name)	\
+	((k)[KERN_SA] = name##SA, (k)[KERN_AS] = name##AS, (k)[KERN_AA] = name##AA)
+
+// Installs the vector kernels of function 'fun' in the entries of the
+// kernel and fold tables, leaving the portable ones where there are none
+void SimdKernels(int fun, NUMKERNEL num[3], INTKERNEL ints[3], NUMFOLD *fold)
+{
+	if (HasAvx2()) {
+		switch (fun) {
+		case APL_UP_STILE:
+			SET(num, AvxMax);	SET(ints, AvxIntMax);	*fold = AvxMaxF;	break;
+		case APL_DOWN_STILE:
+			SET(num, AvxMin);	SET(ints, AvxIntMin);	*fold = AvxMinF;	break;
+		case APL_PLUS:
+			SET(num, AvxPlus);	SET(ints, AvxIntPlus);	*fold = AvxPlusF;	break;
+		case APL_MINUS:			SET(num, AvxMinus);	SET(ints, AvxIntMinus);	break;
+		case APL_TIMES:			SET(num, AvxTimes);	*fold = AvxTimesF;	break;
+		case APL_DIV:			SET(num, AvxDiv);	break;
+		case APL_AND:			SET(num, AvxAnd);	break;
+		case APL_OR:			SET(num, AvxOr);	break;
+		case APL_LESS_THAN:		SET(num, AvxLt);	SET(ints, AvxIntLt);	break;
+		case APL_LT_OR_EQUAL:	SET(num, AvxLe);	SET(ints, AvxIntLe);	break;
+		case APL_EQUAL:			SET(num, AvxEq);	SET(ints, AvxIntEq);	break;
+		case APL_GT_OR_EQUAL:	SET(num, AvxGe);	SET(ints, AvxIntGe);	break;
+		case APL_GREATER_THAN:	SET(num, AvxGt);	SET(ints, AvxIntGt);	break;
+		case APL_NOT_EQUAL:		SET(num, AvxNe);	SET(ints, AvxIntNe);	break;
+		}
+		return;
+	}
+
+	// SSE2 is always present in x86-64
+	switch (fun) {
+	case APL_UP_STILE:		SET(num, SseMax);	*fold = SseMaxF;	break;
+	case APL_DOWN_STILE:	SET(num, SseMin);	*fold = SseMinF;	break;
+	case APL_PLUS:
+		SET(num, SsePlus);	SET(ints, SseIntPlus);	*fold = SsePlusF;	break;
+	case APL_MINUS:			SET(num, SseMinus);	SET(ints, SseIntMinus);	break;
+	case APL_TIMES:			SET(num, SseTimes);	*fold = SseTimesF;	break;
+	case APL_DIV:			SET(num, SseDiv);	break;
+	case APL_AND:			SET(num, SseAnd);	break;
+	case APL_OR:			SET(num, SseOr);	break;
+	case APL_LESS_THAN:		SET(num, SseLt);	break;
+	case APL_LT_OR_EQUAL:	SET(num, SseLe);	break;
+	case APL_EQUAL:			SET(num, SseEq);	break;
+	case APL_GT_OR_EQUAL:	SET(num, SseGe);	break;
+	case APL_GREATER_THAN:	SET(num, SseGt);	break;
+	case APL_NOT_EQUAL:		SET(num, SseNe);	break;
+	}
+}
+
+//
+// Math kernels. exp, log, sin and cos are computed with the fdlibm
+// algorithms (error below 1 ulp), four elements at a time. Arguments
+// outside the ranges of the algorithms (and infinities and NaNs) are
+// passed to libm. The vector and the scalar versions of an algorithm
+// do the same operations in the same order, so each element gets the
+// same result wherever it is in the array.
+
+#define	TOINT		6755399441055744.0		// 0x1.8p52
+#define	TOINT_BITS	0x4338000000000000LL
+
+static const double
+	invln2	= 1.44269504088896338700e+00,
+	ln2hi	= 6.93147180369123816490e-01,
+	ln2lo	= 1.90821492927058770002e-10,
+	P1		= 1.66666666666666019037e-01,
+	P2		= -2.77777777770155933842e-03,
+	P3		= 6.61375632143793436117e-05,
+	P4		= -1.65339022054652515390e-06,
+	P5		= 4.13813679705723846039e-08,
+	Lg1		= 6.666666666666735130e-01,
+	Lg2		= 3.999999999940941908e-01,
+	Lg3		= 2.857142874366239149e-01,
+	Lg4		= 2.222219843214978396e-01,
+	Lg5		= 1.818357216161805012e-01,
+	Lg6		= 1.531383769920937332e-01,
+	Lg7		= 1.479819860511658591e-01,
+	invpio2	= 6.36619772367581382433e-01,
+	pio2_1	= 1.57079632673412561417e+00,
+	pio2_2	= 6.07710050630396597660e-11,
+	pio2_2t	= 2.02226624879595063154e-21,
+	pio2_3	= 2.02226624871116645580e-21,
+	pio2_3t	= 8.47842766036889956997e-32,
+	S1		= -1.66666666666666324348e-01,
+	S2		= 8.33333333332248946124e-03,
+	S3		= -1.98412698298579493134e-04,
+	S4		= 2.75573137070700676789e-06,
+	S5		= -2.50507602534068634195e-08,
+	S6		= 1.58969099521155010221e-10,
+	C1		= 4.16666666666666019037e-02,
+	C2		= -1.38888888888741095749e-03,
+	C3		= 2.48015872894767294178e-05,
+	C4		= -2.75573143513906633035e-07,
+	C5		= 2.08757232129817482790e-09,
+	C6		= -1.13596475577881948265e-11;
+
+static inline uint64_t AsBits(double x)
+{
+	uint64_t i;
+	memcpy(&i, &x, sizeof(i));
+	return i;
+}
+
+static inline double FromBits(uint64_t i)
+{
+	double x;
+	memcpy(&x, &i, sizeof(x));
+	return x;
+}
+
+// exp(x) = 2^k * exp(r), |r| <= ln2/2, for |x| <= 708
+static inline int ExpFast(double x)
+{
+	return fabs(x) <= 708.0;
+}
+
+static double ExpCore(double x)
+{
+	double k = nearbyint(x * invln2);
+	double hi = x - k * ln2hi;
+	double lo = k * ln2lo;
+	double r = hi - lo;
+	double t = r * r;
+	double c = r - t * (P1 + t * (P2 + t * (P3 + t * (P4 + t * P5))));
+	double y = 1.0 - ((lo - (r * c) / (2.0 - c)) - hi);
+
+	return y * FromBits((AsBits(k + TOINT) + 1023) << 52);
+}
+
+// log(x) = k*ln2 + log(1+f), sqrt(2)/2 < 1+f < sqrt(2), for normal x > 0
+static inline int LogFast(double x)
+{
+	return x >= DBL_MIN && x <= DBL_MAX;
+}
+
+static double LogCore(double x)
+{
+	uint64_t ix = AsBits(x) + ((uint64_t)(0x3ff00000 - 0x3fe6a09e) << 32);
+	double k = (double)((int64_t)(ix >> 52) - 0x3ff);
+	double f = FromBits((ix & 0x000fffffffffffffULL) + (0x3fe6a09eULL << 32)) - 1.0;
+	double hfsq = 0.5 * f * f;
+	double s = f / (2.0 + f);
+	double z = s * s;
+	double w = z * z;
+	double t1 = w * (Lg2 + w * (Lg4 + w * Lg6));
+	double t2 = z * (Lg1 + w * (Lg3 + w * (Lg5 + w * Lg7)));
+	double R = t2 + t1;
+
+	return s * (hfsq + R) + k * ln2lo - hfsq + f + k * ln2hi;
+}
+
+// sin(x) and cos(x) = ±sin or ±cos(y0+y1), |y0+y1| <= π/4, with the
+// 3-step Cody-Waite reduction of fdlibm, for |x| <= 1E6
+static inline int SinFast(double x)
+{
+	return fabs(x) <= 1e6;
+}
+
+static double SinCosCore(double x, int quadrant)
+{
+	double fn = nearbyint(x * invpio2);
+	double r, w, t, y0, y1, z, v, res;
+
+	r = x - fn * pio2_1;
+	t = r;
+	w = fn * pio2_2;
+	r = t - w;
+	w = fn * pio2_2t - ((t - r) - w);
+	t = r;
+	w = fn * pio2_3;
+	r = t - w;
+	w = fn * pio2_3t - ((t - r) - w);
+	y0 = r - w;
+	y1 = (r - y0) - w;
+
+	quadrant += (int)fn;
+	z = y0 * y0;
+	w = z * z;
+	if (quadrant & 1) {
+		r = z * (C1 + z * (C2 + z * C3)) + w * w * (C4 + z * (C5 + z * C6));
+		t = 0.5 * z;
+		v = 1.0 - t;
+		res = v + (((1.0 - v) - t) + (z * r - y0 * y1));
+	} else {
+		r = S2 + z * (S3 + z * S4) + z * w * (S5 + z * S6);
+		v = z * y0;
+		res = y0 - ((z * (0.5 * y1 - v * r) - y1) - v * S1);
+	}
+
+	return quadrant & 2 ? -res : res;
+}
+
+// The reduction loses the sign of ¯0
+static double SinCore(double x)
+{
+	return fabs(x) < 0x1p-26 ? x : SinCosCore(x, 0);
+}
+
+static double CosCore(double x)
+{
+	return SinCosCore(x, 1);
+}
+
+#define	CosFast		SinFast
+
+#define	AVX			__attribute__((target("avx2")))
+#define	AVX_SET1(x)	_mm256_set1_pd(x)
+#define	AVX_ADD		_mm256_add_pd
+#define	AVX_SUB		_mm256_sub_pd
+#define	AVX_MUL		_mm256_mul_pd
+#define	AVX_DIV		_mm256_div_pd
+#define	AVX_ABS(x)	_mm256_andnot_pd(AVX_SET1(-0.0), x)
+#define	AVX_ROUND(x)	\
+	_mm256_round_pd(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)
+#define	AVX_BITS	_mm256_castpd_si256
+#define	AVX_DOUBLE	_mm256_castsi256_pd
+
+AVX static inline __m256d AvxExpFast(__m256d x)
+{
+	return _mm256_cmp_pd(AVX_ABS(x), AVX_SET1(708.0), _CMP_LE_OQ);
+}
+
+AVX static inline __m256d AvxExpCore(__m256d x)
+{
+	__m256d k = AVX_ROUND(AVX_MUL(x, AVX_SET1(invln2)));
+	__m256d hi = AVX_SUB(x, AVX_MUL(k, AVX_SET1(ln2hi)));
+	__m256d lo = AVX_MUL(k, AVX_SET1(ln2lo));
+	__m256d r = AVX_SUB(hi, lo);
+	__m256d t = AVX_MUL(r, r);
+	__m256d c, y;
+	__m256i e;
+
+	c = AVX_ADD(AVX_SET1(P4), AVX_MUL(t, AVX_SET1(P5)));
+	c = AVX_ADD(AVX_SET1(P3), AVX_MUL(t, c));
+	c = AVX_ADD(AVX_SET1(P2), AVX_MUL(t, c));
+	c = AVX_ADD(AVX_SET1(P1), AVX_MUL(t, c));
+	c = AVX_SUB(r, AVX_MUL(t, c));
+	y = AVX_DIV(AVX_MUL(r, c), AVX_SUB(AVX_SET1(2.0), c));
+	y = AVX_SUB(AVX_SET1(1.0), AVX_SUB(AVX_SUB(lo, y), hi));
+	e = _mm256_add_epi64(AVX_BITS(AVX_ADD(k, AVX_SET1(TOINT))), _mm256_set1_epi64x(1023));
+
+	return AVX_MUL(y, AVX_DOUBLE(_mm256_slli_epi64(e, 52)));
+}
+
+AVX static inline __m256d AvxLogFast(__m256d x)
+{
+	return _mm256_and_pd(_mm256_cmp_pd(x, AVX_SET1(DBL_MIN), _CMP_GE_OQ),
+		_mm256_cmp_pd(x, AVX_SET1(DBL_MAX), _CMP_LE_OQ));
+}
+
+AVX static inline __m256d AvxLogCore(__m256d x)
+{
+	__m256i ix = _mm256_add_epi64(AVX_BITS(x),
+		_mm256_set1_epi64x((int64_t)(0x3ff00000 - 0x3fe6a09e) << 32));
+	__m256i ik = _mm256_sub_epi64(_mm256_srli_epi64(ix, 52), _mm256_set1_epi64x(0x3ff));
+	__m256d k = AVX_SUB(AVX_DOUBLE(_mm256_add_epi64(ik, _mm256_set1_epi64x(TOINT_BITS))),
+		AVX_SET1(TOINT));
+	__m256d f = AVX_SUB(AVX_DOUBLE(_mm256_add_epi64(
+		_mm256_and_si256(ix, _mm256_set1_epi64x(0x000fffffffffffffLL)),
+		_mm256_set1_epi64x(0x3fe6a09eLL << 32))), AVX_SET1(1.0));
+	__m256d hfsq = AVX_MUL(AVX_MUL(AVX_SET1(0.5), f), f);
+	__m256d s = AVX_DIV(f, AVX_ADD(AVX_SET1(2.0), f));
+	__m256d z = AVX_MUL(s, s);
+	__m256d w = AVX_MUL(z, z);
+	__m256d t1, t2, y;
+
+	t1 = AVX_ADD(AVX_SET1(Lg4), AVX_MUL(w, AVX_SET1(Lg6)));
+	t1 = AVX_ADD(AVX_SET1(Lg2), AVX_MUL(w, t1));
+	t1 = AVX_MUL(w, t1);
+	t2 = AVX_ADD(AVX_SET1(Lg5), AVX_MUL(w, AVX_SET1(Lg7)));
+	t2 = AVX_ADD(AVX_SET1(Lg3), AVX_MUL(w, t2));
+	t2 = AVX_ADD(AVX_SET1(Lg1), AVX_MUL(w, t2));
+	t2 = AVX_MUL(z, t2);
+	y = AVX_MUL(s, AVX_ADD(hfsq, AVX_ADD(t2, t1)));
+	y = AVX_ADD(y, AVX_MUL(k, AVX_SET1(ln2lo)));
+	y = AVX_SUB(y, hfsq);
+	y = AVX_ADD(y, f);
+
+	return AVX_ADD(y, AVX_MUL(k, AVX_SET1(ln2hi)));
+}
+
+AVX static inline __m256d AvxSinFast(__m256d x)
+{
+	return _mm256_cmp_pd(AVX_ABS(x), AVX_SET1(1e6), _CMP_LE_OQ);
+}
+
+#define	AvxCosFast	AvxSinFast
+
+AVX static inline __m256d AvxSinCosCore(__m256d x, int quadrant)
+{
+	__m256d fn = AVX_ROUND(AVX_MUL(x, AVX_SET1(invpio2)));
+	__m256d r, w, t, y0, y1, z, v, s, c, res;
+	__m256i q;
+
+	r = AVX_SUB(x, AVX_MUL(fn, AVX_SET1(pio2_1)));
+	t = r;
+	w = AVX_MUL(fn, AVX_SET1(pio2_2));
+	r = AVX_SUB(t, w);
+	w = AVX_SUB(AVX_MUL(fn, AVX_SET1(pio2_2t)), AVX_SUB(AVX_SUB(t, r), w));
+	t = r;
+	w = AVX_MUL(fn, AVX_SET1(pio2_3));
+	r = AVX_SUB(t, w);
+	w = AVX_SUB(AVX_MUL(fn, AVX_SET1(pio2_3t)), AVX_SUB(AVX_SUB(t, r), w));
+	y0 = AVX_SUB(r, w);
+	y1 = AVX_SUB(AVX_SUB(r, y0), w);
+
+	q = _mm256_add_epi64(AVX_BITS(AVX_ADD(fn, AVX_SET1(TOINT))),
+		_mm256_set1_epi64x(quadrant));
+	z = AVX_MUL(y0, y0);
+	w = AVX_MUL(z, z);
+
+	// Cosine polynomial
+	r = AVX_ADD(AVX_SET1(C2), AVX_MUL(z, AVX_SET1(C3)));
+	r = AVX_MUL(z, AVX_ADD(AVX_SET1(C1), AVX_MUL(z, r)));
+	t = AVX_ADD(AVX_SET1(C5), AVX_MUL(z, AVX_SET1(C6)));
+	t = AVX_MUL(AVX_MUL(w, w), AVX_ADD(AVX_SET1(C4), AVX_MUL(z, t)));
+	r = AVX_ADD(r, t);
+	t = AVX_MUL(AVX_SET1(0.5), z);
+	v = AVX_SUB(AVX_SET1(1.0), t);
+	c = AVX_SUB(AVX_MUL(z, r), AVX_MUL(y0, y1));
+	c = AVX_ADD(AVX_SUB(AVX_SUB(AVX_SET1(1.0), v), t), c);
+	c = AVX_ADD(v, c);
+
+	// Sine polynomial
+	r = AVX_ADD(AVX_SET1(S3), AVX_MUL(z, AVX_SET1(S4)));
+	r = AVX_ADD(AVX_SET1(S2), AVX_MUL(z, r));
+	t = AVX_ADD(AVX_SET1(S5), AVX_MUL(z, AVX_SET1(S6)));
+	r = AVX_ADD(r, AVX_MUL(AVX_MUL(z, w), t));
+	v = AVX_MUL(z, y0);
+	s = AVX_SUB(AVX_MUL(AVX_SET1(0.5), y1), AVX_MUL(v, r));
+	s = AVX_SUB(AVX_MUL(z, s), y1);
+	s = AVX_SUB(y0, AVX_SUB(s, AVX_MUL(v, AVX_SET1(S1))));
+
+	// Odd quadrants take the cosine; the last two are negative
+	res = _mm256_blendv_pd(s, c, AVX_DOUBLE(_mm256_slli_epi64(q, 63)));
+
+	return _mm256_xor_pd(res, AVX_DOUBLE(_mm256_slli_epi64(_mm256_srli_epi64(q, 1), 63)));
+}
+
+AVX static inline __m256d AvxSinCore(__m256d x)
+{
+	__m256d tiny = _mm256_cmp_pd(AVX_ABS(x), AVX_SET1(0x1p-26), _CMP_LT_OQ);
+
+	return _mm256_blendv_pd(AvxSinCosCore(x, 0), x, tiny);
+}
+
+AVX static inline __m256d AvxCosCore(__m256d x)
+{
+	return AvxSinCosCore(x, 1);
+}
+
+// Generates a math kernel from a core algorithm (name##Core), the test
+// of its range (name##Fast) and the libm function for the other elements
+#define	AVX_MATH_KERNEL(name, libm, bad, err)						\
+AVX static void Avx##name(double *pz, double *px, int n)			\
+{																	\
+	__m256d X;														\
+	double xs[4], x;												\
+	int i, j, slow, fail = 0;										\
+	for (i = 0; i + 4 <= n; i += 4) {								\
+		X = _mm256_loadu_pd(px + i);								\
+		_mm256_storeu_pd(pz + i, Avx##name##Core(X));				\
+		slow = _mm256_movemask_pd(Avx##name##Fast(X)) ^ 15;			\
+		if (slow) {													\
+			_mm256_storeu_pd(xs, X);								\
+			for (j = 0; j < 4; ++j)									\
+				if (slow & (1 << j)) {								\
+					x = xs[j];										\
+					fail |= (bad);									\
+					pz[i + j] = libm(x);							\
+				}													\
+		}															\
+	}																\
+	for (; i < n; ++i) {											\
+		x = px[i];													\
+		if (name##Fast(x))											\
+			pz[i] = name##Core(x);									\
+		else {														\
+			fail |= (bad);											\
+			pz[i] = libm(x);										\
+		}															\
+	}																\
+	if (fail)														\
+		EvlError(err);												\
+}
+
+AVX_MATH_KERNEL(Exp,	exp,	0,		0)
+AVX_MATH_KERNEL(Log,	log,	x == 0,	EE_DOMAIN)
+AVX_MATH_KERNEL(Sin,	sin,	0,		0)
+AVX_MATH_KERNEL(Cos,	cos,	0,		0)
+
+// Installs the vector math kernels. The algorithms need SSE4.1 for
+// rounding and 64-bit integer lanes, so the SSE2 fallback is libm.
+void SimdMathKernels(MATHKERNEL math[MATH_KERNELS])
+{
+	if (!HasAvx2())
+		return;
+
+	math[MATH_EXP] = AvxExp;
+	math[MATH_LOG] = AvxLog;
+	math[MATH_CIRCLE + 1] = AvxSin;
+	math[MATH_CIRCLE + 2] = AvxCos;
+}
+
+#else
+
+// No vector kernels for this target
+void SimdKernels(int fun, NUMKERNEL num[3], INTKERNEL ints[3], NUMFOLD *fold)
+{
+}
+
+void SimdMathKernels(MATHKERNEL math[MATH_KERNELS])
+{
+}
+
+#endif
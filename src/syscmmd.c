@@ -196,8 +196,8 @@ int Erase(int argc, char **argv)
 		VNAME *pn = GetName(strlen(argv[i]), argv[i]);
 		if (pn && pn->odesc) {
 			DESC *pd = WKSPTR(pn->odesc);
-			if (ISARRAY(pd))
-				AplHeapFree(pd->doff);
+			if (ISARRAY(pd) && ISEXTSTO(pd))
+				AplHeapRelease(pd);
 			GlobalDescFree(pd);
 			pn->odesc = 0;
 			pn->type = TUND;
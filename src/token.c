@@ -17,11 +17,11 @@ TOKEN AplTokens[] = {
 /* 007 */	{ 0,		ATOM,		0	},	// APL_SYSVAR - System variable
 /* 008 */	{ 0,		MONADIC,	0	},	// APL_SYSFUN1 - Monadic system function
 /* 009 */	{ 0,		DYADIC,		0	},	// APL_SYSFUN2 - Dyadic system function
-/* 010 */	{ 0,		0,			0	},	// Available
-/* 011 */	{ 0,		0,			0	},	// Available
+/* 010 */	{ 0,		ATOM,		0	},	// APL_INT - Integer
+/* 011 */	{ 0,		ATOM,		0	},	// APL_IARR - Integer array
 /* 012 */	{ 0,		LDEL,		0	},	// APL_NL - New line
-/* 013 */	{ 0,		0,			0	},	// Available
-/* 014 */	{ 0,		0,			0	},	// Available
+/* 013 */	{ 0x2378,	DYADIC,		'I'	},	// ⍸
+/* 014 */	{ 0x222A,	MONADIC,	'v'	},	// ∪
 /* 015 */	{ 0x220a,	DYADIC,		'e'	},	// ∊
 /* 016 */	{ 0x2373,	BIADIC,		'i'	},	// ⍳
 /* 017 */	{ 0x2374,	BIADIC,		'r'	},	// ⍴
@@ -76,7 +76,7 @@ TOKEN AplTokens[] = {
 /* 066 */	{ 0x005C,	DYADIC,		0	},	//
 /* 067 */	{ 0x005D,	ATOM,		0	},	// ]
 /* 068 */	{ 0x007C,	BIADIC,		0	},	// |
-/* 069 */	{ 0x007E,	MONADIC,	0	},	// ~
+/* 069 */	{ 0x007E,	BIADIC,		0	},	// ~
 /* 070 */	{ 0x2207,	0,			'g'	},	// ∇
 /* 071 */	{ 0x235D,	0,			','	},	// ⍝
 /* 072 */	{ 0x22C4,	LDEL,		'`'	},	// ⋄
@@ -67,9 +67,13 @@ typedef struct {
 #define	APL_VARSYS			7
 #define	APL_SYSFUN1			8
 #define	APL_SYSFUN2			9
+#define	APL_INT				10
+#define	APL_IARR			11
 
 #define APL_NL				12
 
+#define	APL_IOTA_UNDERBAR	13
+#define	APL_CUP				14
 #define	APL_EPSILON			15
 #define	APL_IOTA			16
 #define	APL_RHO				17